@@ -18,9 +18,22 @@
 void mmu_enable();
 // disable MMU
 void mmu_unable();
+//  enable I-cache, D-cache and branch prediction
+void mmu_enable_caches();
 
 // flush   TLB
 void mmu_flush();
+// flush   TLB entries for address x[ 31 : 12 ] (plus global entries) with ASID x[ 7 : 0 ]
+void mmu_flush_mva( uint32_t x );
+// flush   TLB entries (bar global entries) with ASID x
+void mmu_flush_asid( uint8_t x );
+
+// invalidate I-cache and branch predictor
+void mmu_flush_icache();
+// clean   D-cache line containing address x, i.e., write it back to memory
+void mmu_clean_dcache( uint32_t x );
+// invalidate (without cleaning) the whole L1 D-cache, e.g., before enabling it
+void mmu_inval_dcache();
 
 // configure MMU: set page table pointer #0 to x
 void mmu_set_ptr0( uint32_t* x );
@@ -30,4 +43,7 @@ void mmu_set_ptr1( uint32_t* x );
 // configure MMU: set 2-bit permission field of domain d to x
 void mmu_set_dom( int d, uint8_t x );
 
+// configure MMU: set current ASID to x (via CONTEXTIDR, st. the PROCID field is 0)
+void mmu_set_asid( uint8_t x );
+
 #endif
@@ -24,13 +24,20 @@
 	
 .global mmu_enable
 .global mmu_unable
+.global mmu_enable_caches
 
 .global mmu_flush
+.global mmu_flush_mva
+.global mmu_flush_asid
+.global mmu_flush_icache
+.global mmu_clean_dcache
+.global mmu_inval_dcache
 
 .global mmu_set_ptr0
 .global mmu_set_ptr1
 	
 .global mmu_set_dom
+.global mmu_set_asid
 
 mmu_enable:          mrc   p15, 0, r0, c1, c0, 0 @ read  SCTLR
                      orr   r0, r0, #0x1          @ set   SCTLR[ M ] = 1 => MMU  enable
@@ -44,11 +51,68 @@ mmu_unable:          mrc   p15, 0, r0, c1, c0, 0 @ read  SCTLR
 
                      mov   pc, lr                @ return
 
+mmu_enable_caches:   mrc   p15, 0, r0, c1, c0, 0 @ read  SCTLR
+                     orr   r0, r0, #0x4          @ set   SCTLR[ C ] = 1 => D-cache           enable
+                     orr   r0, r0, #0x1800       @ set   SCTLR[ I ] = 1 => I-cache           enable
+                                                 @ set   SCTLR[ Z ] = 1 => branch prediction enable
+                     mcr   p15, 0, r0, c1, c0, 0 @ write SCTLR
+                     isb
+
+                     mov   pc, lr                @ return
+
 mmu_flush:           mov   r0,     #0x0
                      mcr   p15, 0, r0, c8, c7, 0 @ write TLBIALL
 
                      mov   pc, lr                @ return
 
+mmu_flush_mva:       mcr   p15, 0, r0, c8, c7, 1 @ write TLBIMVA
+
+                     mov   pc, lr                @ return
+
+mmu_flush_asid:      mcr   p15, 0, r0, c8, c7, 2 @ write TLBIASID
+
+                     mov   pc, lr                @ return
+
+mmu_flush_icache:    mov   r0,     #0x0
+                     mcr   p15, 0, r0, c7, c5, 0 @ write ICIALLU
+                     mcr   p15, 0, r0, c7, c5, 6 @ write BPIALL
+                     dsb
+                     isb
+
+                     mov   pc, lr                @ return
+
+mmu_clean_dcache:    mcr   p15, 0, r0, c7, c10, 1 @ write DCCMVAC
+
+                     mov   pc, lr                @ return
+
+mmu_inval_dcache:    stmfd sp!, { r4, r5 }
+
+                     mov   r0, #0x0
+                     mcr   p15, 2, r0, c0, c0, 0 @ write CSSELR: select L1 D-cache
+                     isb
+                     mrc   p15, 1, r0, c0, c0, 0 @ read  CCSIDR
+                     and   r1, r0, #0x7
+                     add   r1, r1, #4            @ compute log2( line size )
+                     ldr   r2, =0x3FF
+                     and   r2, r2, r0, lsr #3    @ compute number of ways - 1
+                     ldr   r3, =0x7FFF
+                     and   r3, r3, r0, lsr #13   @ compute number of sets - 1
+                     clz   r12, r2               @ compute shift st. way is in top bits
+
+l0:                  mov   r4, r2                @ for each set r3 ...
+l1:                  mov   r5, r4, lsl r12       @ ... and each way r4
+                     orr   r5, r5, r3, lsl r1
+                     mcr   p15, 0, r5, c7, c6, 2 @ write DCISW
+                     subs  r4, r4, #1
+                     bge   l1
+                     subs  r3, r3, #1
+                     bge   l0
+
+                     dsb
+                     ldmfd sp!, { r4, r5 }
+
+                     mov   pc, lr                @ return
+
 mmu_set_ptr0:        mcr   p15, 0, r0, c2, c0, 0 @ write TTBR0
 
                      mov   pc, lr                @ return
@@ -69,3 +133,6 @@ mmu_set_dom:         add   r0, r0, r0            @ compute i (index      from do
 
                      mov   pc, lr                @ return
 
+mmu_set_asid:        mcr   p15, 0, r0, c13, c0, 1 @ write CONTEXTIDR
+
+                     mov   pc, lr                @ return
@@ -6,80 +6,1098 @@
  */
 
 #include "hilevel.h"
+#include     "tty.h"
+#include   "trace.h"
+#include    "klog.h"
+
+pcb_t* current = NULL; // the low-level handlers save into and restore from current->ctx
+
+/* PCBs and pipes are allocated from slab caches (see kmem.h), so creating
+ * or terminating a process is constant time however many there are.  PIDs
+ * are allocated from a counter, so a PID is never reused (or, at least,
+ * not until the counter wraps) even though PCBs are: a stale PID held by,
+ * e.g., a pipe or a call to kill cannot refer to whichever process happens
+ * to get the same PCB next.
+ */
+
+kmem_cache_t pcb_cache;
+kmem_cache_t pipe_cache;
 
-/* Since we *know* there will be 2 processes, stemming from the 2 user
- * programs, we can
+pid_t  pid_next = 2; // 1 is the console
+
+/* Anything addressed by PID (e.g., kill or nice) finds the PCB via an open-
+ * addressed hash table with linear probing.  There can be at most PROC_MAX
+ * processes, i.e., half as many as pool pages (each process owns at least
+ * one, for its page tables, and usually more), and the table has twice
+ * that many entries, so it is at most half full and probe sequences stay
+ * short.  Since PIDs are allocated in sequence, a multiplicative (Fibonacci)
+ * hash spreads them well.  Removal shifts back any later entry in the same
+ * cluster that would otherwise become unreachable, so there are no
+ * tombstones to build up over time.
  *
- * - allocate a fixed-size process table (of PCBs), and then maintain
- *   an index into it for the currently executing process,
- * - employ a fixed-case of round-robin scheduling: no more processes
- *   can be created, and neither is able to terminate.
+ * Every process is also on proc_all, in PID order (bar wrap round), for
+ * anything (e.g., ps) that has to visit each one.
  */
 
-pcb_t pcb[ 30 ]; // By changing the number you can vary the number of programs being run (1.b)
-int n = 1;//sizeof(pcb)/sizeof(pcb[0]); // Get the size of pcb (divide the whole array b the size of each element)
-int executing = 0;
-pipe_t pipes[ 60 ];
+#ifndef PID_BITS
+#define PID_BITS  ( POOL_BITS ) // which may be set lower, e.g., so user/Pstress.c forces collisions
+#endif
+#define PID_SLOTS ( 1 << PID_BITS )
+#define PROC_MAX  ( PID_SLOTS / 2 )
+
+pcb_t* pid_index[ PID_SLOTS ];
+pcb_t* proc_all  = NULL;
+pcb_t* proc_last = NULL;
+
+int pid_hash( pid_t pid ) {
+  return ( int )( ( ( uint32_t )( pid ) * 0x9E3779B1 ) >> ( 32 - PID_BITS ) );
+}
+
+void pid_insert( pcb_t* p ) {
+  int i = pid_hash( p->pid );
 
-//init, reset, findnextpipeslot
+  while( pid_index[ i ] != NULL ) {
+    i = ( i + 1 ) & ( PID_SLOTS - 1 );
+  }
+
+  pid_index[ i ] = p;
+
+  p->all_prev = proc_last;
+  p->all_next = NULL;
+
+  if( proc_last != NULL ) {
+    proc_last->all_next = p;
+  }
+  else {
+    proc_all            = p;
+  }
 
-void init_pipe( int pipe_id) {
-  memset( &pipes[ pipe_id ], 0, sizeof( pipe_t ) );
-  pipes[ pipe_id ].parent      = (pid_t) (-1);
-  pipes[ pipe_id ].child      = (pid_t) (-1);
-  pipes[ pipe_id ].data      = 0;
-  pipes[ pipe_id ].inUse     = false;
+  proc_last = p;
 }
 
-int next_available_pipe() {
-  for (int i = 3; i<60; i++) {
-    if (!pipes[i].inUse) {
-      return i;
+void pid_remove( pcb_t* p ) {
+  int i = pid_hash( p->pid );
+
+  while( pid_index[ i ] != p ) {
+    i = ( i + 1 ) & ( PID_SLOTS - 1 );
+  }
+
+  pid_index[ i ] = NULL;
+
+  for( int j = ( i + 1 ) & ( PID_SLOTS - 1 ); pid_index[ j ] != NULL; j = ( j + 1 ) & ( PID_SLOTS - 1 ) ) {
+    int h = pid_hash( pid_index[ j ]->pid );
+
+    // move entry j into the hole at i, unless its home h lies cyclically in ( i, j ]
+    if( ( ( j - h ) & ( PID_SLOTS - 1 ) ) >= ( ( j - i ) & ( PID_SLOTS - 1 ) ) ) {
+      pid_index[ i ] = pid_index[ j ];
+      pid_index[ j ] = NULL;
+      i = j;
     }
   }
+
+  if( p->all_prev != NULL ) {
+    p->all_prev->all_next = p->all_next;
+  }
+  else {
+    proc_all              = p->all_next;
+  }
+  if( p->all_next != NULL ) {
+    p->all_next->all_prev = p->all_prev;
+  }
+  else {
+    proc_last             = p->all_prev;
+  }
 }
 
+// find the process (or thread) with a given PID, zombies included, or NULL if there is none
+pcb_t* pid_find( pid_t pid ) {
+  if( pid <= 0 ) {
+    return NULL;
+  }
 
-void round_robin_scheduler( ctx_t* ctx ) {
+  for( int i = pid_hash( pid ); pid_index[ i ] != NULL; i = ( i + 1 ) & ( PID_SLOTS - 1 ) ) {
+    if( pid_index[ i ]->pid == pid ) {
+      return pid_index[ i ];
+    }
+  }
 
-    // Round robin scheduler - starts at 0 and increases pcb index by 1 using executingNext
-    int executingNext = (executing + 1)%n; //check that the next one is ready
-    memcpy( &pcb[ executing ].ctx, ctx, sizeof( ctx_t ) ); // preserve P_1
-    pcb[ executing ].status = STATUS_READY;                // update   P_1 status
-    memcpy( ctx, &pcb[ executingNext ].ctx, sizeof( ctx_t ) ); // restore  P_2
-    pcb[ executingNext ].status = STATUS_EXECUTING;            // update   P_2 status
-    executing = executingNext;                                 // update   index => P_2
+  return NULL;
+}
 
-    PL011_putc( UART0, executing+'0', true );
-  return;
+void pcb_ctor( void* x ) {
+  memset( x, 0, sizeof( pcb_t ) );
 }
 
-void priority_scheduler( ctx_t* ctx ) {
+pcb_t* pcb_alloc() {
+  return ( pcb_cache.inuse < PROC_MAX ) ? kmem_alloc( &pcb_cache ) : NULL;
+}
 
-    //If age = priority then do the memcpy stuff and reset the age. If it doesnt then do nothting and just carry on.
-    if ( pcb[ executing ].age == pcb[ executing ].basePriority) {
+void child_link( pcb_t* p, pcb_t* c ) {
+  c->parent   = p;
+  c->sib_prev = NULL;
+  c->sib_next = p->children;
 
-      int executingNext = 0;
-      pcb[ executing ].age = 0;
+  if( p->children != NULL ) {
+    p->children->sib_prev = c;
+  }
 
-      for (int i=(executing+1)%n; i < n; i++) {
-        if (pcb[i].status == STATUS_READY) { //Find first AVAILABLE pcb
-          executingNext = i;
-          break;
-        }
-      }
+  p->children = c;
+}
 
-      memcpy( &pcb[ executing ].ctx, ctx, sizeof( ctx_t ) ); // preserve executing
-      pcb[ executing ].status = STATUS_READY;                // update executing's status
-      memcpy( ctx, &pcb[ executingNext ].ctx, sizeof( ctx_t ) ); // restore next program
-      pcb[ executingNext ].status = STATUS_EXECUTING;            // update next program's status
-      executing = executingNext;
+void child_unlink( pcb_t* c ) {
+  if( c->sib_prev != NULL ) {
+    c->sib_prev->sib_next = c->sib_next;
+  }
+  else {
+    c->parent->children   = c->sib_next;
+  }
+  if( c->sib_next != NULL ) {
+    c->sib_next->sib_prev = c->sib_prev;
+  }
 
-      PL011_putc( UART0, executing+'0', true );
-      return;
+  c->parent   = NULL;
+  c->sib_prev = NULL;
+  c->sib_next = NULL;
+}
+
+void pcb_release( pcb_t* p ); // since the two are mutually recursive
+
+// make every child of p an orphan, freeing any that have already exited since nothing can now collect their status
+void proc_orphan( pcb_t* p ) {
+  while( p->children != NULL ) {
+    pcb_t* c = p->children;
+
+    child_unlink( c );
+
+    if( c->exited ) {
+      pcb_release( c );
+    }
+  }
+}
+
+/* Release a PCB, and the address space it owns, having taken it out of
+ * its parent's list of children and orphaned its own.  If p is the executing
+ * process, though, current (and acct_who) still point at it until the
+ * kernel is exited, so it is only marked STATUS_TERMINATED (which stops it
+ * being queued again) and then freed by kernel_exit.
+ */
+
+pcb_t* pcb_dead = NULL;
+
+void pcb_release( pcb_t* p ) {
+  waitq_wake( &p->joiners ); // any still waiting to join p find it gone
+  waitq_wake( &p->waiters );
+
+  proc_orphan( p );
+
+  if( p->parent != NULL ) {
+    child_unlink( p );
+  }
+
+  if( p->pid   != 0 ) {
+    pid_remove( p );
+  }
+  if( p->space != NULL ) {
+    space_free( p->space );
+  }
+
+  p->pid    = 0;
+  p->space  = NULL;
+  p->status = STATUS_TERMINATED;
+
+  if( p == current ) {
+    pcb_dead = p;
+  }
+  else {
+    kmem_free( &pcb_cache, p );
+  }
+}
+
+pid_t pid_alloc() {
+  pid_t pid = pid_next++;
+
+  if( pid_next <= 1 ) {
+    pid_next = 2; // wrapped round
+  }
+
+  return pid;
+}
+
+/* File descriptors 4 and up map to pipes (0 ... 3 are the ttys) via an
+ * index, which starts off as one page and doubles whenever it fills up, so
+ * is only as large as the number of pipes open at once demands.  The free
+ * entries are threaded onto a free list, so allocating or freeing an fd is
+ * constant time (bar the odd doubling): since pipes come from a slab cache,
+ * so are 8-byte aligned, a free entry holds the next free fd shifted left
+ * by one and with bit 0 set, which cannot be mistaken for a pipe.
+ *
+ * A pipe is held by the process that created it, and by (at most two)
+ * processes that open it.  Each drops its hold by closing it, or else by
+ * terminating, and once there are none left the pipe and its fd are freed,
+ * first waking anything still blocked on it (which then finds it gone).
+ */
+
+#define PIPE_FREE( fd ) ( ( pipe_t* )( ( ( fd ) << 1 ) | 1 ) )
+#define PIPE_NEXT( x  ) ( ( int )( ( int32_t )( x ) >> 1 ) )
+#define PIPE_NONE       ( -1 ) // the end of the free list
+
+pipe_t** pipes      = NULL;
+int      pipe_order = 0;         // the index is a block of 2^pipe_order pages ...
+int      pipe_slots = 0;         // ... holding this many entries
+int      pipe_free  = PIPE_NONE; // the first free fd
+
+void pipe_ctor( void* x ) {
+  pipe_t* p = ( pipe_t* )( x );
+
+  memset( p, 0, sizeof( pipe_t ) );
+  p->owner  = ( pid_t )( -1 );
+  p->parent = ( pid_t )( -1 );
+  p->child  = ( pid_t )( -1 );
+  p->inUse  = true;
+}
+
+pipe_t* pipe_fd( int fd ) {
+  if( fd < 4 || fd >= pipe_slots || ( ( uint32_t )( pipes[ fd ] ) & 1 ) ) {
+    return NULL;
+  }
+
+  return pipes[ fd ];
+}
+
+// allocate the index, or double it, threading every new entry onto the free list; return false if impossible
+bool pipe_grow() {
+  int      k = ( pipes != NULL ) ? ( pipe_order + 1 ) : 0;
+  pipe_t** x = ( pipe_t** )( pages_alloc( k ) );
+
+  if( x == NULL ) {
+    return false;
+  }
+
+  int n = ( PAGE_SIZE << k ) / sizeof( pipe_t* ), m = ( pipes != NULL ) ? pipe_slots : 4;
+
+  if( pipes != NULL ) {
+    memcpy( x, pipes, pipe_slots * sizeof( pipe_t* ) ); pages_free( ( uint32_t )( pipes ), pipe_order );
+  }
+  else {
+    memset( x, 0, m * sizeof( pipe_t* ) ); // the ttys
+  }
+
+  for( int i = n - 1; i >= m; i-- ) { // so fds are handed out lowest first
+    x[ i ] = PIPE_FREE( pipe_free ); pipe_free = i;
+  }
+
+  pipes      = x;
+  pipe_order = k;
+  pipe_slots = n;
+
+  return true;
+}
+
+// give pipe p an fd, or return -1 if impossible
+int pipe_alloc( pipe_t* p ) {
+  if( pipe_free == PIPE_NONE && !pipe_grow() ) {
+    return -1;
+  }
+
+  int fd = pipe_free;
+
+  pipe_free   = PIPE_NEXT( pipes[ fd ] );
+  pipes[ fd ] = p;
+
+  return fd;
+}
+
+// drop every hold process g has on pipe fd, freeing it once nothing holds it; return false if g held nothing
+bool pipe_drop( int fd, pid_t g ) {
+  pipe_t* p = pipes[ fd ];
+  bool    r = ( p->owner == g ) || ( p->parent == g ) || ( p->child == g );
+
+  p->owner  = ( p->owner  == g ) ? ( pid_t )( -1 ) : p->owner;
+  p->parent = ( p->parent == g ) ? ( pid_t )( -1 ) : p->parent;
+  p->child  = ( p->child  == g ) ? ( pid_t )( -1 ) : p->child;
+
+  if( p->owner == -1 && p->parent == -1 && p->child == -1 ) {
+    waitq_wake( &p->rd_wait );
+    waitq_wake( &p->wr_wait );
+
+    kmem_free( &pipe_cache, p );
+
+    pipes[ fd ] = PIPE_FREE( pipe_free ); pipe_free = fd;
+  }
+
+  return r;
+}
+
+// drop every hold process g has on any pipe, e.g., since it terminated
+void pipe_exit( pid_t g ) {
+  for( int fd = 4; fd < pipe_slots; fd++ ) {
+    if( pipe_fd( fd ) != NULL ) {
+      pipe_drop( fd, g );
+    }
+  }
+}
+
+int pipe_read( pipe_t* p, uint8_t* x, int n ) {
+  int r = 0;
+
+  while( r < n && p->tail != p->head ) {
+    x[ r++ ] = p->buf[ p->tail++ & ( PIPE_SIZE - 1 ) ];
+  }
+
+  if( r > 0 ) {
+    waitq_wake( &p->wr_wait );
+  }
+
+  return r;
+}
+
+int pipe_write( pipe_t* p, const uint8_t* x, int n ) {
+  int r = 0;
+
+  while( r < n && ( p->head - p->tail ) < PIPE_SIZE ) {
+    p->buf[ p->head++ & ( PIPE_SIZE - 1 ) ] = x[ r++ ];
+  }
+
+  if( r > 0 ) {
+    waitq_wake( &p->rd_wait );
+  }
+
+  return r;
+}
+
+waitq_t futex_bucket[ FUTEX_BUCKETS ];
+
+// the address space a futex at x is qualified by, i.e., that of the executing process iff. x is per-process
+mm_space_t* futex_space( uint32_t x ) {
+  return space_local( x ) ? current->space : NULL;
+}
+
+waitq_t* futex_queue( mm_space_t* s, uint32_t x ) {
+  return &futex_bucket[ ( ( x ^ ( uint32_t )( s ) ) * 0x9E3779B1 ) >> ( 32 - FUTEX_BITS ) ];
+}
+
+/* READY processes are held in two run queues, active and expired: the
+ * next process is always picked from active, and a process that has
+ * used up its slice (or yields) is moved to expired.  Once active is
+ * empty, the two are swapped.  This means a high priority process can
+ * go first, but cannot starve a lower priority one: everything READY
+ * is guaranteed a slice before anything gets a second one.  A process
+ * that becomes READY for any other reason (e.g., having been created)
+ * goes straight into active.
+ *
+ * The executing process is never queued, so it has to be enqueued again
+ * (if it is still able to execute) before the next one is picked.
+ */
+
+runqueue_t  rqs[ 2 ];
+runqueue_t* active  = &rqs[ 0 ];
+runqueue_t* expired = &rqs[ 1 ];
+
+/* The base level for a nice value spreads NICE_MIN ... NICE_MAX over
+ * levels 6 ... 25, leaving room either side for the interactivity bonus
+ * or penalty of at most INTERACTIVE_MAX / 2 levels.
+ */
+
+int nice_level( pcb_t* p ) {
+  int l = ( ( p->nice - NICE_MIN ) / 2 ) + 6 - ( p->interactive - ( INTERACTIVE_MAX / 2 ) );
+
+  return ( l < 0 ) ? 0 : ( l >= RQ_LEVELS ) ? ( RQ_LEVELS - 1 ) : l;
+}
+
+/* Slices are longer for higher static priority, from 800ms at NICE_MIN
+ * through 100ms at 0 to 5ms at NICE_MAX (cf. the Linux O(1) scheduler).
+ */
+
+uint32_t nice_quantum( int nice ) {
+  int s = 20 - nice;
+
+  return ( nice < 0 ) ? ( s * 20000 ) : ( s * 5000 );
+}
+
+void rq_enqueue( runqueue_t* rq, pcb_t* p ) {
+  int l = p->priority = nice_level( p );
+
+  p->queue = rq;
+  p->prev  = rq->tail[ l ];
+  p->next  = NULL;
+
+  if( rq->tail[ l ] != NULL ) {
+    rq->tail[ l ]->next = p;
+  }
+  else {
+    rq->head[ l ]       = p;
+  }
+
+  rq->tail[ l ] = p;
+  rq->bitmap   |= ( 0x80000000 >> l );
+}
+
+void rq_dequeue( pcb_t* p ) {
+  runqueue_t* rq = p->queue; int l = p->priority;
+
+  if( p->prev != NULL ) {
+    p->prev->next = p->next;
+  }
+  else {
+    rq->head[ l ] = p->next;
+  }
+  if( p->next != NULL ) {
+    p->next->prev = p->prev;
+  }
+  else {
+    rq->tail[ l ] = p->prev;
+  }
+
+  p->queue = NULL;
+  p->prev  = NULL;
+  p->next  = NULL;
+
+  if( rq->head[ l ] == NULL ) {
+    rq->bitmap &= ~( 0x80000000 >> l );
+  }
+}
+
+bool rq_empty() {
+  return ( active->bitmap == 0 ) && ( expired->bitmap == 0 );
+}
+
+pcb_t* rq_pick() {
+  if( active->bitmap == 0 ) {
+    runqueue_t* t = active; active = expired; expired = t;
+  }
+  if( active->bitmap == 0 ) {
+    return NULL;
+  }
+
+  pcb_t* p = active->head[ __builtin_clz( active->bitmap ) ];
+  rq_dequeue( p );
+
+  return p;
+}
+
+/* Real-time processes are scheduled by a separate, Earliest Deadline First
+ * (EDF) class that always takes precedence over the run queues above.  A
+ * process joins it by declaring a period, budget and (relative) deadline:
+ * it is then released once per period, and each release (or job) may use
+ * at most budget ticks of processor time before the deadline.  A process
+ * signals that the current job is complete by yielding; if it instead
+ * exhausts the budget, it is throttled until the next release.
+ *
+ * READY real-time processes are kept in rt_ready, ordered by absolute
+ * deadline, and those waiting for their next release in rt_waiting,
+ * ordered by release time; since these lists only ever hold the (few)
+ * admitted real-time processes, a sorted insertion is fine.
+ *
+ * Admission control keeps the total density, i.e., the sum of budget /
+ * deadline over every real-time process, at most 1; since deadline <=
+ * period, this also bounds the utilisation, and is sufficient for EDF
+ * to meet every deadline.  Densities are held as 16.16 fixed-point.
+ */
+
+#define RT_DENSITY_MAX ( 0x00010000 )
+
+pcb_t*   rt_ready   = NULL;
+pcb_t*   rt_waiting = NULL;
+uint32_t rt_density = 0;
+
+void rt_insert( pcb_t** list, pcb_t* p, uint32_t key ) {
+  pcb_t* q = *list; pcb_t* r = NULL;
+
+  p->rt.key    = key;
+  p->rt.queued = true;
+
+  while( q != NULL && ( int32_t )( q->rt.key - key ) <= 0 ) {
+    r = q; q = q->next;
+  }
+
+  p->prev = r;
+  p->next = q;
+
+  if( r != NULL ) {
+    r->next = p;
+  }
+  else {
+    *list   = p;
+  }
+  if( q != NULL ) {
+    q->prev = p;
+  }
+}
+
+void rt_remove( pcb_t** list, pcb_t* p ) {
+  p->rt.queued = false;
+
+  if( p->prev != NULL ) {
+    p->prev->next = p->next;
+  }
+  else {
+    *list         = p->next;
+  }
+  if( p->next != NULL ) {
+    p->next->prev = p->prev;
+  }
+
+  p->prev = NULL;
+  p->next = NULL;
+}
+
+uint32_t rt_density_of( pcb_t* p ) {
+  return ( uint32_t )( ( ( uint64_t )( p->rt.budget ) << 16 ) / p->rt.deadline );
+}
+
+/* Put the executing (real-time) process to sleep until its next release,
+ * either because the current job is complete or because it exhausted the
+ * budget.
+ */
+
+void rt_sleep( pcb_t* p ) {
+  p->status = STATUS_WAITING;
+  rt_insert( &rt_waiting, p, p->rt.release + p->rt.period );
+}
+
+/* Release a new job for every real-time process whose next release time
+ * has been reached; if the previous job is still pending at this point,
+ * it has missed the deadline (which is never after the next release).
+ */
+
+void rt_release() {
+  uint32_t t = clock_now();
+
+  while( rt_waiting != NULL && ( int32_t )( t - rt_waiting->rt.key ) >= 0 ) {
+    pcb_t* p = rt_waiting; rt_remove( &rt_waiting, p );
+
+    if( p->rt.pending ) {
+      p->rt.misses++;
+    }
+
+    p->rt.release   = p->rt.key;
+    p->rt.remaining = p->rt.budget;
+    p->rt.pending   = true;
+    p->status       = STATUS_READY;
+
+    rt_insert( &rt_ready, p, p->rt.release + p->rt.deadline );
+  }
+}
+
+/* Make a real-time process READY again after it blocked (e.g., in sleep,
+ * read or futex_wait) rather than waiting for its next release, during
+ * which none of its releases happened: if its period has since rolled
+ * over, it catches up to the job of the current period, with a fresh
+ * budget and deadline, and each job in between (plus the one it blocked
+ * in, if still pending) counts as missed.  Otherwise, a stale deadline
+ * would put it ahead of every other job, and the releases it missed would
+ * then follow back-to-back, beyond the density it was admitted with.
+ */
+
+void rt_resume( pcb_t* p ) {
+  uint32_t n = ( clock_now() - p->rt.release ) / p->rt.period; // periods since the current job was released
+
+  if( n > 0 ) {
+    p->rt.misses   += ( n - 1 ) + ( p->rt.pending ? 1 : 0 );
+    p->rt.release  += n * p->rt.period;
+    p->rt.remaining = p->rt.budget;
+    p->rt.pending   = true;
+  }
+
+  rt_insert( &rt_ready, p, p->rt.release + p->rt.deadline );
+}
+
+/* Remove a real-time process from the class altogether, e.g., because it
+ * is terminated, making whatever it had reserved available again.
+ */
+
+void rt_detach( pcb_t* p ) {
+  if     ( p->rt.queued && p->status == STATUS_READY   ) {
+    rt_remove( &rt_ready,   p );
+  }
+  else if( p->rt.queued && p->status == STATUS_WAITING ) {
+    rt_remove( &rt_waiting, p );
+  }
+
+  rt_density -= rt_density_of( p );
+
+  memset( &p->rt, 0, sizeof( rt_t ) );
+}
+
+void waitq_remove( pcb_t* p ) {
+  waitq_t* q = p->waitq;
+
+  if( p->prev != NULL ) {
+    p->prev->next = p->next;
+  }
+  else {
+    q->head       = p->next;
+  }
+  if( p->next != NULL ) {
+    p->next->prev = p->prev;
+  }
+  else {
+    q->tail       = p->prev;
+  }
+
+  p->waitq = NULL;
+  p->prev  = NULL;
+  p->next  = NULL;
+}
+
+/* Take a process out of whichever queue it is in, and cancel anything
+ * it is waiting for, e.g., because it is about to be terminated.
+ */
+
+void sched_remove( pcb_t* p ) {
+  if     ( p->rt.on        ) {
+    rt_detach( p );
+  }
+  else if( p->queue != NULL ) {
+    rq_dequeue( p );
+  }
+
+  if( p->waitq != NULL ) {
+    waitq_remove( p );
+  }
+
+  timer_cancel( &p->timer );
+}
+
+/* Create a process from scratch, executing from pc with a fresh (i.e.,
+ * zeroed) stack of n bytes and nice value x: unlike fork then exec, which
+ * first duplicates the page tables of the caller only to throw the copy
+ * away again, this just allocates what the new process needs.  It is not
+ * queued, so the caller decides when it can execute.  Returns NULL if the
+ * PCB or stack could not be allocated.
+ */
+
+pcb_t* proc_create( uint32_t pc, int x, uint32_t n ) {
+  pcb_t* p = pcb_alloc();
+
+  if( p == NULL ) {
+    return NULL;
+  }
+
+  p->space = space_alloc();
+
+  if( p->space == NULL || !space_stack( p->space, n ) ) {
+    pcb_release( p );
+    return NULL;
+  }
+
+  p->status      = STATUS_READY;
+  p->ctx.cpsr    = 0x50;
+  p->ctx.pc      = pc;
+  p->ctx.sp      = STACK_TOP - TLS_SIZE;
+  p->tls         = STACK_TOP - TLS_SIZE;
+  p->stack_size  = n;
+  p->stack_top   = STACK_TOP;
+  p->nice        = x;
+  p->quantum     = nice_quantum( x );
+  p->interactive = INTERACTIVE_MAX / 2;
+  p->pid         = pid_alloc();
+  p->tgid        = p->pid;
+  pid_insert( p );
+
+  return p;
+}
+
+/* Create a thread in the same process as p, executing from pc with x as
+ * its argument and a fresh stack of n bytes in a free slot of the address
+ * space it shares with p.  As above, it is not queued, and NULL is returned
+ * if the PCB or stack could not be allocated.
+ */
+
+pcb_t* proc_thread( pcb_t* p, uint32_t pc, uint32_t x, uint32_t n ) {
+  pcb_t*   t = pcb_alloc();
+  uint32_t top;
+
+  if( t == NULL ) {
+    return NULL;
+  }
+  if( ( top = space_thread( p->space, n ) ) == 0 ) {
+    pcb_release( t );
+    return NULL;
+  }
+
+  t->space       = space_get( p->space );
+  t->status      = STATUS_READY;
+  t->ctx.cpsr    = 0x50;
+  t->ctx.pc      = pc;
+  t->ctx.gpr[ 0 ] = x;
+  t->ctx.sp      = top - TLS_SIZE;
+  t->tls         = top - TLS_SIZE;
+  t->stack_size  = n;
+  t->stack_top   = top;
+  t->nice        = p->nice;
+  t->quantum     = p->quantum;
+  t->interactive = p->interactive;
+  t->pid         = pid_alloc();
+  t->tgid        = p->tgid;
+  pid_insert( t );
+
+  return t;
+}
+
+/* Reap a process (or thread), i.e., take it out of whichever queue it is
+ * in and give its PCB and stack back (bar freeing the PCB of the executing
+ * process, which pcb_release defers).
+ */
+
+void proc_reap( pcb_t* p ) {
+  sched_remove( p );
+  pcb_release( p );
+}
+
+/* Reap every thread in group g (zombies included) bar keep, e.g., since a
+ * process terminates as a whole even if only one of its threads exits (or
+ * is killed), returning true iff. this reaped the executing process.
+ */
+
+bool group_reap( pid_t g, pcb_t* keep ) {
+  bool r = false;
+
+  for( pcb_t* p = proc_all, * q; p != NULL; p = q ) {
+    q = p->all_next;
+
+    if( p->tgid == g && p != keep ) {
+      r |= ( p == current ); proc_reap( p );
+    }
+  }
+
+  return r;
+}
+
+/* Terminate the process p belongs to, with exit status x: every thread is
+ * reaped bar the first, which is kept as a zombie, so the parent can collect
+ * the status, and the parent (alone) is woken in case it is waiting for it.
+ * With no parent, there is nothing to wait, so the zombie is freed straight
+ * away.  Returns true iff. this terminated the executing process.
+ */
+
+bool proc_exit( pcb_t* p, int x ) {
+  pcb_t* l = pid_find( p->tgid );
+  bool   r = ( p->tgid == current->tgid );
+
+  if( l == NULL || l->exited ) {
+    return false;
+  }
+
+  group_reap( p->tgid, l );
+  sched_remove( l );
+  pipe_exit( l->pid );
+
+  if( l->space != NULL ) {
+    space_free( l->space );
+  }
+
+  l->space       = NULL;
+  l->status      = STATUS_TERMINATED;
+  l->exited      = true;
+  l->exit_status = x;
+
+  proc_orphan( l );
+
+  if( l->parent != NULL ) {
+    waitq_wake( &l->parent->waiters );
+  }
+  else {
+    pcb_release( l );
+  }
+
+  return r;
+}
+
+/* Make a WAITING process READY again, in whichever class it belongs to.
+ */
+
+void sched_wake( pcb_t* p ) {
+  trace( TRACE_WAKE, p->pid, 0 );
+
+  p->status = STATUS_READY;
+
+  if( p->rt.on ) {
+    rt_resume( p );
+  }
+  else {
+    rq_enqueue( active, p );
+  }
+}
+
+void sleep_expire( ktimer_t* t ) {
+  sched_wake( ( pcb_t* )( ( uint8_t* )( t ) - offsetof( pcb_t, timer ) ) );
+}
+
+/* The idle task executes (in USR mode, like any other process) whenever
+ * nothing else is READY, e.g., because every process is either waiting
+ * or terminated: it never enters the run queue, and just waits for the
+ * next interrupt rather than spinning.  The kernel drains its log each
+ * time it is about to resume the idle task (see kernel_exit), so once
+ * UART0 cannot keep up, the transmit interrupt is what drains some more.
+ */
+
+pcb_t idle;
+
+void idle_task() {
+  while( 1 ) {
+    asm volatile( "wfi" );
+  }
+}
+
+/* Rather than interrupting at a fixed rate, TIMER0 is a one-shot timer
+ * reprogrammed on the way out of the kernel to fire at the next actual
+ * deadline, i.e., whichever is first of
+ *
+ * - the end of the executing process' slice, if anything else is READY
+ *   (otherwise there is no-one to preempt in favour of),
+ * - the end of the executing process' budget, if it is real-time, or
+ * - the next release of a real-time process.
+ *
+ * If there is no such deadline, the timer is simply stopped.
+ */
+
+#define SLICE_MIN    ( 0x00000010 )
+
+uint32_t slice_start;
+uint32_t slice_end;
+
+uint32_t tick_armed; // cycle count when TIMER0 was last armed
+uint32_t tick_delay; // number of clock ticks TIMER0 was last armed for
+
+void tick_reprogram() {
+  TIMER0->Timer1Ctrl  = 0x00000000; // disable          timer
+
+  bool     armed = false;
+  uint32_t t     = 0;
+
+  if( current->rt.on || !rq_empty() ) {
+    armed = true;  t = slice_end;
+  }
+  if( rt_waiting != NULL && ( !armed || ( int32_t )( rt_waiting->rt.key - t ) < 0 ) ) {
+    armed = true;  t = rt_waiting->rt.key;
+  }
+
+  if( !armed ) {
+    return;
+  }
+
+  int32_t d = ( int32_t )( t - clock_now() );
+
+  tick_delay          = ( d < SLICE_MIN ) ? SLICE_MIN : d;
+
+  TIMER0->Timer1Load  = tick_delay;
+  TIMER0->Timer1Ctrl  = 0x00000002; // select 32-bit    timer
+  TIMER0->Timer1Ctrl |= 0x00000001; // select one-shot  timer
+  TIMER0->Timer1Ctrl |= 0x00000020; // enable           timer interrupt
+  TIMER0->Timer1Ctrl |= 0x00000080; // enable           timer
+
+  tick_armed          = cycles_now();
+}
+
+/* Switch to the process next, which must already have been removed from
+ * the run queue.  Since the low-level handlers preserve the USR registers
+ * straight into current->ctx, and restore them from wherever current then
+ * points, there is nothing to copy: the switch is just a pointer update.
+ */
+
+void dispatch( pcb_t* next ) {
+  trace( TRACE_SWITCH, next->pid, current->pid );
+
+  if( next != current && ( next->space == NULL || next->space != current->space ) ) {
+    space_switch( next->space );   // NULL for the idle task, and unchanged between threads of one process
+  }
+  if( next != current ) {
+    asm volatile( "clrex \n" );   // so a STREX cannot succeed on the strength of an LDREX by some other process
+  }
+
+  next->status = STATUS_EXECUTING; // update next status
+  current      = next;             // update pointer => next
+
+  asm volatile( "mcr p15, 0, %0, c13, c0, 3 \n" // write TPIDRURO = next->tls
+              :
+              : "r" (next->tls) );
+
+  slice_start  = clock_now();
+  slice_end    = slice_start + ( next->rt.on ? next->rt.remaining : next->quantum );
+}
+
+/* Put the executing process back in the run queue rq if it is still able
+ * to execute (a real-time process is charged for the time it used, and
+ * goes back into rt_ready instead), then dispatch whichever process has
+ * the earliest deadline or otherwise heads the run queue.
+ */
+
+void reschedule( runqueue_t* rq ) {
+  pcb_t* prev = current; bool runnable = ( prev->status == STATUS_EXECUTING );
+
+  if( prev->rt.on ) {
+    uint32_t used = clock_now() - slice_start;
+
+    prev->rt.remaining = ( used < prev->rt.remaining ) ? ( prev->rt.remaining - used ) : 0;
+  }
+
+  if( prev->status == STATUS_EXECUTING && prev != &idle ) {
+    prev->status = STATUS_READY;
+
+    if( prev->rt.on ) {
+      rt_insert( &rt_ready, prev, prev->rt.key );
+    }
+    else {
+      rq_enqueue( rq, prev );
+    }
+  }
+
+  pcb_t* next = rt_ready;
+
+  if( next != NULL ) {
+    rt_remove( &rt_ready, next );
   }
   else {
-      pcb[ executing ].age = pcb[ executing ].age + 1;
+    next = rq_pick();
+  }
+
+  if( next == NULL ) {
+    next = &idle; // nothing is READY: wait for something to be
+  }
+
+  if( next != prev ) {
+    if( runnable ) {
+      prev->acct.nivcsw++;
+    }
+    else {
+      prev->acct.nvcsw++;
+    }
+  }
+
+  dispatch( next );
+}
+
+/* Time is charged at kernel entry and exit: everything since the last
+ * exit is USR mode time for whatever was executing, and everything since
+ * the last entry is kernel time for whatever the kernel was entered on
+ * behalf of (even if the kernel then switched to a different process).
+ */
+
+pcb_t*   acct_who;   // process the kernel was last entered on behalf of
+uint32_t acct_stamp; // time of the last kernel entry or exit
+
+void acct_enter() {
+  uint32_t t = clock_now();
+
+  current->acct.utime += t - acct_stamp;
+  acct_who             = current;
+  acct_stamp           = t;
+}
+
+void acct_exit() {
+  uint32_t t = clock_now();
+
+  acct_who->acct.stime += t - acct_stamp;
+  acct_stamp            = t;
+}
+
+/* Called on the way out of every high-level handler: any real-time jobs
+ * due are released, then the executing process is preempted as soon as
+ * something with a higher priority is READY (which, for the idle task,
+ * is anything at all), and the timer is then set for whatever the next
+ * deadline is.
+ */
+
+void kernel_exit() {
+  rt_release();
+
+  if( current == &idle ) {
+    if( rt_ready != NULL || !rq_empty() ) {
+      reschedule( active );
+    }
+  }
+  else if( current->status == STATUS_EXECUTING && rt_ready != NULL ) {
+    if( !current->rt.on || ( int32_t )( rt_ready->rt.key - current->rt.key ) < 0 ) {
+      reschedule( active );
+    }
+  }
+  else if( current->status == STATUS_EXECUTING && active->bitmap != 0 && !current->rt.on ) {
+    if( __builtin_clz( active->bitmap ) < nice_level( current ) ) {
+      reschedule( active );
+    }
+  }
+
+  tick_reprogram();
+  trace_drain();
+
+  if( current == &idle ) {
+    klog_drain();
+  }
+
+  acct_exit();
+
+  if( pcb_dead != NULL && pcb_dead != current ) {
+    kmem_free( &pcb_cache, pcb_dead ); pcb_dead = NULL;
+  }
+}
+
+/* Adjust the interactivity score of the executing process, which gave up
+ * the processor either voluntarily (up = true) or not (up = false).
+ */
+
+void interactive_update( bool up ) {
+  if     (  up && current->interactive < INTERACTIVE_MAX ) {
+    current->interactive++;
+  }
+  else if( !up && current->interactive > 0               ) {
+    current->interactive--;
+  }
+}
+
+/* Block the executing process until q is woken.  Note that a process
+ * blocked in a system call (e.g., read) has already had the PC wound back
+ * by the caller, so the system call is simply issued again once woken and
+ * rechecks whatever it was waiting for: this is why waking every process
+ * is fine, since any that lose the race just block again.
+ */
+
+void waitq_block( waitq_t* q ) {
+  pcb_t* p = current;
+
+  p->status = STATUS_WAITING;
+  p->waitq  = q;
+  p->prev   = q->tail;
+  p->next   = NULL;
+
+  if( q->tail != NULL ) {
+    q->tail->next = p;
+  }
+  else {
+    q->head       = p;
+  }
+
+  q->tail = p;
+
+  if( !p->rt.on ) {
+    interactive_update( true );
+  }
+
+  reschedule( active );
+}
+
+void waitq_wake( waitq_t* q ) {
+  while( q->head != NULL ) {
+    pcb_t* p = q->head; waitq_remove( p ); sched_wake( p );
+  }
+}
+
+void priority_scheduler() {
+
+    //If the slice is over (or the executing process can no longer execute) then switch. If not then just carry on.
+    if ( current->status != STATUS_EXECUTING || (int32_t)(clock_now() - slice_end) >= 0) {
+
+      if ( current->status == STATUS_EXECUTING && current->rt.on ) {
+        rt_sleep( current ); //budget exhausted, so throttle until the next release
+      }
+      else if ( current->status == STATUS_EXECUTING ) {
+        interactive_update( false );
+      }
+
+      reschedule( expired );
+
+      klog_putc( KLOG_DEBUG, current->pid+'0' );
+      return;
   }
 }
 
@@ -93,29 +1111,84 @@ extern uint32_t tos_Ptemp;
 extern void     main_P5();
 extern uint32_t tos_P5;
 extern void     main_console();
-extern uint32_t tos_console;
-extern uint32_t tos_newProcesses;
+extern uint32_t tos_idle;
+
+
+
+/* TIMER1 is left free-running as a monotonic clock, which wraps round
+ * roughly every 71 minutes; it counts down, so the complement gives an
+ * increasing count of ticks (at 1MHz) since reset.
+ */
+
+uint32_t clock_now() {
+  return ~TIMER1->Timer1Value;
+}
+
+/* The PMU cycle counter is enabled at reset, and made readable from USR
+ * mode so user programs can time things at the same resolution.
+ */
+
+uint32_t cycles_now() {
+  uint32_t r;
+
+  asm volatile( "mrc p15, 0, %0, c9, c13, 0 \n" // read PMCCNTR
+              : "=r" (r) );
+
+  return r;
+}
+
+/* The entry latency of each TIMER0 interrupt, i.e., the number of cycles
+ * from when it was due (per tick_reprogram) to when the handler started,
+ * is kept for the last IRQ_LATENCY_MAX interrupts.
+ */
+
+#define IRQ_LATENCY_MAX ( 64 )
+
+uint32_t irq_latency[ IRQ_LATENCY_MAX ];
+uint32_t irq_latency_count = 0;
 
+/* The cost of handling each timer tick, i.e., the context switch from the
+ * IRQ vector to the point the USR registers of whichever process is next
+ * are restored (bar the few instructions that do so), is accumulated in
+ * cycles, so it can be inspected (e.g., via gdb) when tuning the switch:
+ * the mean is switch_latency_sum / switch_latency_count.
+ */
 
+uint64_t switch_latency_sum   = 0;
+uint32_t switch_latency_count = 0;
 
-void hilevel_handler_rst(ctx_t* ctx) {
+void hilevel_handler_rst() {
   /* Configure the mechanism for interrupt handling by
    *
-   * - configuring timer st. it raises a (periodic) interrupt for each
-   *   timer tick,
+   * - configuring timer st. it raises an interrupt at the end of each
+   *   slice (see tick_reprogram, which sets the period each time),
    * - configuring GIC st. the selected interrupts are forwarded to the
    *   processor via the IRQ interrupt signal, then
    * - enabling IRQ interrupts.
    */
 
-  TIMER0->Timer1Load  = 0x00100000; // select period = 2^20 ticks ~= 1 sec
-  TIMER0->Timer1Ctrl  = 0x00000002; // select 32-bit   timer
-  TIMER0->Timer1Ctrl |= 0x00000040; // select periodic timer
-  TIMER0->Timer1Ctrl |= 0x00000020; // enable          timer interrupt
-  TIMER0->Timer1Ctrl |= 0x00000080; // enable          timer
+  mm_init(); // identity map, then enable the MMU, caches and branch prediction before anything else
+
+  asm volatile( "mcr p15, 0, %0, c9, c14, 0 \n" // write PMUSERENR: allow USR mode access to PMU
+                "mcr p15, 0, %1, c9, c12, 0 \n" // write PMCR: reset and enable counters
+                "mcr p15, 0, %2, c9, c12, 1 \n" // write PMCNTENSET: enable cycle counter
+              :
+              : "r" (0x00000001), "r" (0x00000005), "r" (0x80000000) );
+
+  TIMER1->Timer1Load  = 0xFFFFFFFF; // select period = 2^32 ticks
+  TIMER1->Timer1Ctrl  = 0x00000002; // select 32-bit   timer
+  TIMER1->Timer1Ctrl |= 0x00000080; // enable free-running timer
+
+  timer_init();
+  tty_init();
+  trace_init();
 
   GICC0->PMR          = 0x000000F0; // unmask all            interrupts
-  GICD0->ISENABLER1  |= 0x00000010; // enable timer          interrupt
+  GICD0->ISENABLER1  |= 0x00000010; // enable timer 0        interrupt
+  GICD0->ISENABLER1  |= 0x00000020; // enable timer 1        interrupt
+  GICD0->ISENABLER1  |= 0x00001000; // enable UART 0         interrupt
+  GICD0->ISENABLER1  |= 0x00002000; // enable UART 1         interrupt
+  GICD0->ISENABLER1  |= 0x00008000; // enable UART 3         interrupt
   GICC0->CTLR         = 0x00000001; // enable GIC interface
   GICD0->CTLR         = 0x00000001; // enable GIC distributor
 
@@ -128,89 +1201,96 @@ void hilevel_handler_rst(ctx_t* ctx) {
    * - the PC and SP values matche the entry point and top of stack.
    */
 
-  memset( &pcb[ 0 ], 0, sizeof( pcb_t ) );
-  pcb[ 0 ].pid      = 1;
-  pcb[ 0 ].status   = STATUS_READY;
-  pcb[ 0 ].ctx.cpsr = 0x50;
-  pcb[ 0 ].ctx.pc   = ( uint32_t )( &main_console ); ///////
-  pcb[ 0 ].ctx.sp   = ( uint32_t )( &tos_console );
-  pcb[ 0 ].basePriority = 0;                   //Setting console to high priority so that it continues to execute.
-  pcb[ 0 ].age = 0;
-
-  //Initialise pipes as well
-  for (int i=0; i<60; i++) {               //hardcoded 60 for now.
-    init_pipe(i);
-  }
-
-
-  // memset( &pcb[ 1 ], 0, sizeof( pcb_t ) );
-  // pcb[ 1 ].pid      = 2;
-  // pcb[ 1 ].status   = STATUS_READY;
-  // pcb[ 1 ].ctx.cpsr = 0x50;
-  // pcb[ 1 ].ctx.pc   = ( uint32_t )( &main_P4 );
-  // pcb[ 1 ].ctx.sp   = ( uint32_t )( &tos_P4  );
-  // pcb[ 1 ].basePriority = 2;
-  // pcb[ 1 ].age = 0;
-
-  // memset( &pcb[ 1 ], 0, sizeof( pcb_t ) );
-  // pcb[ 1 ].pid      = 2;
-  // pcb[ 1 ].status   = STATUS_READY;
-  // pcb[ 1 ].ctx.cpsr = 0x50;
-  // pcb[ 1 ].ctx.pc   = ( uint32_t )( &main_P4 );
-  // pcb[ 1 ].ctx.sp   = ( uint32_t )( &tos_P4  );
-  // pcb[ 1 ].basePriority = 2;
-  // pcb[ 1 ].age = 0;
-  //
-  // memset( &pcb[ 2 ], 0, sizeof( pcb_t ) );
-  // pcb[ 2 ].pid      = 3;
-  // pcb[ 2 ].status   = STATUS_READY;
-  // pcb[ 2 ].ctx.cpsr = 0x50;
-  // pcb[ 2 ].ctx.pc   = ( uint32_t )( &main_Ptemp );
-  // pcb[ 2 ].ctx.sp   = ( uint32_t )( &tos_Ptemp  );
-  // pcb[ 2 ].basePriority = 1;
-  // pcb[ 2 ].age = 0;
-
-  // memset( &pcb[ 3 ], 0, sizeof( pcb_t ) ); //this is usually pcb2
-  // pcb[ 3 ].pid      = 4;
-  // pcb[ 3 ].status   = STATUS_READY;
-  // pcb[ 3 ].ctx.cpsr = 0x50;
-  // pcb[ 3 ].ctx.pc   = ( uint32_t )( &main_P5 );
-  // pcb[ 3 ].ctx.sp   = ( uint32_t )( &tos_P5  );
-  // pcb[ 3 ].basePriority = 6;
-  // pcb[ 3 ].age = 0;
-
-  /* Once the PCBs are initialised, we (arbitrarily) select one to be
-   * restored (i.e., executed) when the function then returns.
+  kmem_cache_init( &pcb_cache,  "pcb",  sizeof( pcb_t  ), pcb_ctor  );
+  kmem_cache_init( &pipe_cache, "pipe", sizeof( pipe_t ), pipe_ctor );
+
+  memset( pid_index, 0, sizeof( pid_index ) );
+  memset( futex_bucket, 0, sizeof( futex_bucket ) );
+
+  proc_all  = NULL;
+  proc_last = NULL;
+  pid_next  = 1; // so the console is PID 1
+  pipes      = NULL;
+  pipe_slots = 0;
+  pipe_free  = PIPE_NONE;
+
+  pcb_t* console = proc_create( ( uint32_t )( &main_console ), 0, STACK_DEFAULT );
+
+  memset( &idle, 0, sizeof( pcb_t ) );
+  idle.pid      = 0;
+  idle.status   = STATUS_READY;
+  idle.ctx.cpsr = 0x50;
+  idle.ctx.pc   = ( uint32_t )( &idle_task );
+  idle.ctx.sp   = ( uint32_t )( &tos_idle  );
+
+  memset( rqs, 0, sizeof( rqs ) );
+
+  /* Once the console is created, the kernel is left as if it had been
+   * entered from the idle task, so dispatching the console switches to it
+   * in the usual way, and it is restored when the function then returns.
    */
-  PL011_putc( UART0, 'R', true );
+  klog_putc( KLOG_DEBUG, 'R' );
 
-  memcpy( ctx, &pcb[ 0 ].ctx, sizeof( ctx_t ) );
-  pcb[ 0 ].status = STATUS_EXECUTING;
-  executing = 0;
+  current    = &idle;
+  acct_who   = &idle;
+  acct_stamp = clock_now();
+
+  dispatch( console );
+  kernel_exit();
 
   int_enable_irq();
 
   return;
 }
 
-void hilevel_handler_irq(ctx_t* ctx) {
-  // Step 2: read  the interrupt identifier so we know the source.
+void hilevel_handler_irq( ctx_t* ctx, uint32_t c ) {
+  // Step 2: read  the interrupt identifier so we know the source (c is the cycle count on entry).
 
   uint32_t id = GICC0->IAR;
 
+  acct_enter();
+
+  if( id != GIC_SOURCE_UART3 ) { // draining the trace must not itself add to it
+    trace( TRACE_IRQ_ENTER, current->pid, id );
+  }
+
   // Step 4: handle the interrupt, then clear (or reset) the source.
 
   if( id == GIC_SOURCE_TIMER0 ) {
-    PL011_putc( UART0, 'T', true );
+    irq_latency[ irq_latency_count++ % IRQ_LATENCY_MAX ] = c - tick_armed - tick_delay * ( CPU_HZ / CLOCK_HZ );
+
+    klog_putc( KLOG_DEBUG, 'T' );
     TIMER0->Timer1IntClr = 0x01;
-    priority_scheduler(ctx);
-    //round_robin_scheduler(ctx);
+    priority_scheduler();
+  }
+  else if( id == GIC_SOURCE_TIMER1 ) {
+    timer_irq();
+  }
+  else if( id == GIC_SOURCE_UART0  ) {
+    tty_irq( &tty[ 0 ] );
+  }
+  else if( id == GIC_SOURCE_UART1  ) {
+    tty_irq( &tty[ 1 ] );
+  }
+  else if( id == GIC_SOURCE_UART3  ) {
+    trace_irq();
   }
 
   // Step 5: write the interrupt identifier to signal we're done.
 
   GICC0->EOIR = id;
 
+  if( id != GIC_SOURCE_UART3 ) {
+    trace( TRACE_IRQ_EXIT,  current->pid, id );
+  }
+
+  kernel_exit();
+
+  if( id == GIC_SOURCE_TIMER0 ) {
+    switch_latency_sum   += cycles_now() - c;
+    switch_latency_count += 1;
+  }
+
   return;
 }
 
@@ -223,23 +1303,61 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
    * - write any return value back to preserved usr mode registers.
    */
 
+  pid_t caller = current->pid;
+
+  acct_enter();
+  current->acct.syscalls++;
+
+  trace( TRACE_SVC_ENTER, caller, id );
+
   switch( id ) {
-    // case 0x00 : { // 0x00 => yield()
-    //   round_robin_scheduler( ctx );
-    //   break;
-    // }
+    case 0x00 : { // 0x00 => yield()
+      if( current->rt.on ) { // real-time job complete: wait for the next release
+        if( ( int32_t )( clock_now() - current->rt.key ) > 0 ) {
+          current->rt.misses++;
+        }
+        current->rt.pending = false;
+        rt_sleep( current );
+      }
+      else {
+        interactive_update( true );
+      }
+      reschedule( expired );
+      break;
+    }
 
     case 0x01 : { // 0x01 => write( fd, x, n )
       int   fd = ( int   )( ctx->gpr[ 0 ] );
       char*  x = ( char* )( ctx->gpr[ 1 ] );
       int    n = ( int   )( ctx->gpr[ 2 ] );
 
-      //if(fd < 3) {
-        for( int i = 0; i < n; i++ ) {
-          PL011_putc( UART0, *x++, true );
-        }
-      //} else pipes[ fd ].data = n; //The parameter n needs to be the data i.e. 0 for fork availble, 1 for it being used.
-      ctx->gpr[ 0 ] = n;
+      tty_t*  t = tty_fd( fd );
+      pipe_t* p = pipe_fd( fd );
+
+      int r; waitq_t* q;
+
+      if     ( n < 0 || ( n > 0 && !space_read( current->space, ( uint32_t )( x ), n ) ) ) {
+        ctx->gpr[ 0 ] = -1; // never let the kernel read (e.g., the pool) on behalf of a process that cannot
+        break;
+      }
+      else if( t != NULL ) {
+        r = tty_write( t, ( uint8_t* )( x ), n ); q = &t->tx_wait;
+      }
+      else if( p != NULL ) {
+        r = pipe_write( p, ( uint8_t* )( x ), n ); q = &p->wr_wait;
+      }
+      else {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      if( r == 0 && n > 0 ) {
+        ctx->pc -= 4; // re-issue the svc once there is space to write
+        waitq_block( q );
+        break;
+      }
+
+      ctx->gpr[ 0 ] = r;
       break;
     }
 
@@ -248,14 +1366,37 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
       char*  x = ( char* )( ctx->gpr[ 1 ] );
       int    n = ( int   )( ctx->gpr[ 2 ] );
 
-      for( int i = 0; i < n; i++ ) {
-        *x = PL011_getc( UART0 , true );
-        x++;
+      tty_t*  t = tty_fd( fd );
+      pipe_t* p = pipe_fd( fd );
+
+      int r; waitq_t* q;
+
+      if     ( n < 0 || ( n > 0 && !space_write( current->space, ( uint32_t )( x ), n ) ) ) {
+        ctx->gpr[ 0 ] = -1; // copy-on-write pages are copied before the kernel writes to them
+        break;
+      }
+      else if( t != NULL ) {
+        r = tty_read( t, ( uint8_t* )( x ), n ); q = &t->rx_wait;
+      }
+      else if( p != NULL ) {
+        r = pipe_read( p, ( uint8_t* )( x ), n ); q = &p->rd_wait;
+      }
+      else {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
+
+      if( r == 0 && n > 0 ) {
+        ctx->pc -= 4; // re-issue the svc once there is something to read
+        waitq_block( q );
+        break;
       }
 
-      PL011_putc( UART0, 'x', true );
+      if( t != NULL ) {
+        klog_putc( KLOG_DEBUG, 'x' );
+      }
 
-      ctx->gpr[ 0 ] = n;
+      ctx->gpr[ 0 ] = r;
       break;
     }
 
@@ -280,68 +1421,51 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
 
     case 0x03 : { //fork
 
-      pcb_t* parent = &pcb[executing];
-      pcb_t* child = &pcb[ n ]; //find first available pcb space
-
-      memcpy( &parent->ctx, ctx, sizeof( ctx_t ) );
+      pcb_t* parent = current; // ctx is parent->ctx, so already up to date
+      pcb_t* child = pcb_alloc(); //take a free slot, if there is one
 
-      memset( child, 0, sizeof(pcb_t));
+      if (child == NULL) {
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
 
-      //memcpy( &pcb[ n+1 ].ctx, ctx, sizeof( ctx_t ));
-      memcpy( child, parent, sizeof(pcb_t));
-      child->pid = n + 1;
+      mm_space_t* space = space_fork( parent->space ); //the child shares the parent's stack, copy-on-write
 
-      uint32_t parentTos = (uint32_t) &tos_newProcesses-(executing*0x00001000);
-      int offset = (uint32_t) parentTos - parent->ctx.sp;
+      if (space == NULL) {
+        pcb_release( child );
+        ctx->gpr[ 0 ] = -1;
+        break;
+      }
 
-      uint32_t childTos = (uint32_t) &tos_newProcesses-((n)*0x00001000);
-      memcpy((void *) childTos - 0x00001000, (void *) parentTos - 0x00001000, 0x00001000 ); //minus 0x00001000 from childTos and parentTos ??
-      child->ctx.sp = (uint32_t) childTos - offset;
+      memcpy( child, parent, sizeof(pcb_t));
+      memset( &child->rt, 0, sizeof(rt_t)); //the real-time reservation (if any) is not inherited
+      memset( &child->acct, 0, sizeof(acct_t)); //nor is the accounting
+      memset( &child->joiners, 0, sizeof(waitq_t));
+      memset( &child->waiters, 0, sizeof(waitq_t));
+      child->children = NULL; //nor are the children
+      child->pid = pid_alloc();
+      child->tgid = child->pid; //a process of its own, even if forked by a thread
+      pid_insert( child );
+      child_link( pid_find( parent->tgid ), child ); //a child of the process, not just of the thread
+      child->space = space; //and, since it is at the same address, the same sp and tls
 
       child->status = STATUS_READY;
+      rq_enqueue( active, child );
+
+      trace( TRACE_FORK, parent->pid, child->pid );
 
 
       ctx->gpr[ 0 ] = child->pid;
       child->ctx.gpr[ 0 ] = 0;
-      n++;
 
       break;
-      //hilevel handler reset is being called!! Something is setting pc/lr to 0 and therefore starting it all over again.
-
-
-      //create new child pcb and copy the values from the parent
-      // memset( &pcb[ n+1 ], 0, sizeof( pcb_t ) );
-      // pcb[ n+1 ].pid      = pcb[ executing ].pid + 1;                      //unique PID but is it a problem for this to be hardcoded>
-      // pcb[ n+1 ].status   = STATUS_READY;
-      // pcb[ n+1 ].ctx.cpsr = pcb[ executing ].ctx.cpsr;
-      // pcb[ n+1 ].ctx.pc   = pcb[ executing ].ctx.pc;
-      // pcb[ n+1 ].ctx.sp   = pcb[ executing ].ctx.sp;
-      // pcb[ n+1 ].basePriority = pcb[ executing ].basePriority;
-      // pcb[ n+1 ].age = pcb[ executing ].age;                           /////////////////////////
-      //
-      // //Copy parents stack to child's stack
-      // memcpy(tos_newProcesses+(n+1)*1000, tos_newProcesses+executing*1000, 0x00001000 ); // 1) top of stack of child, 2)top of stack of parent, 3) size of what im copying
-      // int offset = tos_newProcesses+executing*1000 - pcb[ executing ].ctx.sp; //where the stack pointer is in relation to the top of stack
-      // pcb[n+1].ctx.sp = tos_newProcesses+(n+1)*1000 - offset; //Minus offset so that stack pointer is in same position relative to parent
-      //
-      // //I have made space (tos_newProcesses) for new processes, somehow have to handle that space here. ^^^^
-      //
-      // //  - return value is 0 for child, and PID of child for parent.
-      // parent->ctx.gpr[ 0 ] = child->pid;
-      // child->ctx.gpr[ 0 ] = 0;
-      //
-      // break;
-
-      //The maximum size of pcb is 1!! PROBLEM.
-      //Shell was being printed over and over again.
-
     }
 
     case 0x04 : { //exit
-      memset( &pcb[ executing ], 0, sizeof( pcb_t ) );
-      pcb[ executing ].status = STATUS_TERMINATED;   //P5 has a limit of 50 therefore calls exit (0x04), handle this.
-      //pcb[ executing ].basePriority = -1;
-      priority_scheduler(ctx);
+      trace( TRACE_EXIT, current->pid, ctx->gpr[ 0 ] );
+
+      proc_exit( current, ctx->gpr[ 0 ] );   //P5 has a limit of 50 therefore calls exit (0x04), handle this.
+      priority_scheduler();
       break;
     }
 
@@ -354,50 +1478,162 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
 
      case 0x05 : { //exec
 
-       PL011_putc( UART0, 'E', true );
+       klog_putc( KLOG_DEBUG, 'E' );
+
+       trace( TRACE_EXEC, current->pid, 0 );
+
+       uint32_t size = ( ctx->gpr[1] == 0 ) ? STACK_DEFAULT : PAGE_ROUND( ctx->gpr[1] );
+       mm_space_t* space = ( size != 0 && size <= STACK_MAX && current->pid == current->tgid ) ? space_alloc() : NULL; //only the first thread of a process, which lasts as long as it does, can exec
+
+       if (space != NULL && !space_stack( space, size )) {
+         space_free( space ); space = NULL;
+       }
+       if (space == NULL) { //keep executing the current image, and fail
+         ctx->gpr[0] = -1;
+         break;
+       }
+
+       group_reap( current->tgid, current ); // any other threads go along with the old image
+       space_free( current->space ); // the new stack is zeroed, so this also resets the thread-local area
+       current->space      = space;
+       current->stack_size = size;
+       current->stack_top  = STACK_TOP;
+       space_switch( space );
 
-       memset((uint32_t)&tos_newProcesses-(executing*0x00001000)-0x00001000, 0, 0x00001000);
        ctx->pc = ctx->gpr[0];
-       ctx->sp = (uint32_t) &tos_newProcesses-(executing*0x00001000);
-
-       // void* main_newprocess = (void *)ctx->gpr[ 0 ];
-       //
-       //
-       // memcpy(&pcb[ executing ].ctx, ctx, sizeof( ctx_t ) ); // preserve process that was executing
-       // pcb[ executing ].status = STATUS_READY;                // update  the status of executing process
-       //
-       // pcb[n+1].ctx.pc = (uint32_t) (main_newprocess);
-       //
-       //
-       //
-       //
-       // memcpy( ctx, &pcb[ n+1].ctx, sizeof( ctx_t ) ); // restore  process to execute
-       // pcb[ n+1 ].status = STATUS_EXECUTING;            // update   the status of the executing process
-       // executing = n+1; //sets the process that is excuting to the new process
-       //
+       ctx->sp = STACK_TOP - TLS_SIZE;
+       current->tls = STACK_TOP - TLS_SIZE;
+
        break;
      }
      case 0x06 : { //kill
        // for process identified by pid, send signal of x
       int pid = ctx->gpr[0];       //////////this PID is 3! Because I wrote terminate 3
-      for (int i=0;i<n;i++) {
-        if (pcb[i].pid == pid) {
-          PL011_putc( UART0, 'K', true );
-          memset( &pcb[ i ], 0, sizeof( pcb_t ) );
-          pcb[ i ].status = STATUS_TERMINATED;
-          break;
-          //pcb[ i ].basePriority = -1;
+      pcb_t* p = pid_find( pid );
+      ctx->gpr[0] = ( p != NULL ) ? 0 : -1; //a zombie can still be killed, to no effect, until it is waited for
+      if (p != NULL) {
+        klog_putc( KLOG_DEBUG, 'K' );
+        trace( TRACE_KILL, current->pid, pid );
+        if (proc_exit( p, EXIT_KILLED )) { //the whole process, i.e., every thread in it
+          priority_scheduler(); //killed itself, so pick something else to execute
+        }
+      }
+      break;
+     }
+
+     case 0x07 : { //nice
+       // for process identified by pid, set static priority (i.e., nice value) to x
+      int pid = ctx->gpr[0];
+      int x   = ctx->gpr[1];
+
+      x = ( x < NICE_MIN ) ? NICE_MIN : ( x > NICE_MAX ) ? NICE_MAX : x;
+
+      pcb_t* p = pid_find( pid );
+      ctx->gpr[0] = ( p != NULL && p->status != STATUS_TERMINATED ) ? 0 : -1;
+      if (p != NULL && p->status != STATUS_TERMINATED) {
+        p->nice    = x;
+        p->quantum = nice_quantum( x );
+        if (p->queue != NULL) {  //requeue at the new level, in the same run queue
+          runqueue_t* rq = p->queue;
+          rq_dequeue( p );
+          rq_enqueue( rq, p );
         }
       }
       break;
      }
 
+     case 0x0A : { //sched_rt
+       // join (or, if period = 0, leave) the real-time class with period, budget and deadline
+      uint32_t period   = ctx->gpr[0];
+      uint32_t budget   = ctx->gpr[1];
+      uint32_t deadline = ctx->gpr[2];
+
+      if (period == 0) {
+        if (current->rt.on) {
+          rt_detach( current );
+        }
+        ctx->gpr[0] = 0;
+        break;
+      }
+      if (budget == 0 || budget > deadline || deadline > period) {
+        ctx->gpr[0] = -1;
+        break;
+      }
+
+      uint32_t d = ( uint32_t )( ( ( uint64_t )( budget ) << 16 ) / deadline );
+      uint32_t o = current->rt.on ? rt_density_of( current ) : 0;
+
+      if (rt_density - o + d > RT_DENSITY_MAX) { //admission control: reject if over-subscribed
+        ctx->gpr[0] = -1;
+        break;
+      }
+
+      rt_density = rt_density - o + d;
+
+      current->rt.on        = true;
+      current->rt.period    = period;
+      current->rt.budget    = budget;
+      current->rt.deadline  = deadline;
+      current->rt.release   = clock_now(); //first job is released straight away
+      current->rt.key       = current->rt.release + deadline;
+      current->rt.remaining = budget;
+      current->rt.pending   = true;
+      current->rt.misses    = 0;
+
+      slice_start = current->rt.release;
+      slice_end   = current->rt.release + budget;
+
+      ctx->gpr[0] = 0;
+      break;
+     }
+
+     case 0x0B : { //sched_rt_misses
+       // for process identified by pid, get the number of deadlines missed
+      int pid = ctx->gpr[0];
+
+      pcb_t* p = pid_find( pid );
+
+      ctx->gpr[0] = ( p != NULL ) ? p->rt.misses : -1;
+      break;
+     }
+
+     case 0x0C : { //sleep
+       // wait (in STATUS_WAITING, so without using the processor) for x microseconds
+      uint32_t x = ctx->gpr[0];
+
+      ctx->gpr[0] = 0;
+
+      if (x == 0) {
+        break;
+      }
+
+      current->status   = STATUS_WAITING;
+      current->timer.fn = sleep_expire;
+      timer_add( &current->timer, x );
+
+      if (!current->rt.on) {
+        interactive_update( true );
+      }
+      reschedule( active );
+      break;
+     }
+
      case 0x08 : { //pipe
-       PL011_putc( UART0, '%', true );
+       klog_putc( KLOG_DEBUG, '%' );
 
-       int fd = next_available_pipe();
+       pipe_t* p = kmem_alloc( &pipe_cache );
+       int fd = ( p != NULL ) ? pipe_alloc( p ) : -1;
 
-       pipes[fd].inUse = true;
+       if (fd < 0) {
+         if (p != NULL) {
+           kmem_free( &pipe_cache, p );
+         }
+         ctx->gpr[0] = -1;
+         break;
+       }
+
+       p->owner = current->tgid; //held by the process, not just the thread, until it closes it or terminates
+       trace( TRACE_PIPE, current->pid, fd );
 
        ctx->gpr[0] = fd;
 
@@ -405,7 +1641,7 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
      }
 
      case 0x09 : { //OPEN
-       PL011_putc( UART0, '@', true );
+       klog_putc( KLOG_DEBUG, '@' );
        //Fd (from pipe) is the parameter, ctx-\>gpr[0]
        //if pipe= inUSe
        //check if it has a parent, otherwise set parent to current processes pid
@@ -413,18 +1649,22 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
        //else its already used at both ends so fail. return gpr (-1)
 
        int fd = (int) (ctx->gpr[0]);
-       int pid = pcb[ executing ].pid;
+       int pid = current->pid;
+
+       trace( TRACE_OPEN, pid, fd );
 
-       if (!pipes[fd].inUse) {
+       pipe_t* p = pipe_fd( fd );
+
+       if (p == NULL) {
          ctx->gpr[0] = (-1);
          break;
-       } else if (pipes[fd].parent == -1) {
+       } else if (p->parent == -1) {
          //If it has no parent, set it here
-         pipes[ fd ].parent = (pid_t) (pid);
+         p->parent = current->tgid;
        }
-       else if (pipes[fd].child == -1) {
+       else if (p->child == -1) {
          //If it has no parent, set it here
-         pipes[ fd ].child = (pid_t) (pid);
+         p->child = current->tgid;
        }
        else {
          //Otherwise fail because pipe already used at both ends
@@ -432,19 +1672,369 @@ void hilevel_handler_svc( ctx_t* ctx, uint32_t id ) {
          break;
        }
 
-       //If success, do this. Not actually really used..
-       ctx->gpr[0] = next_available_pipe();
+       //If success, return the fd. Not actually really used..
+       ctx->gpr[0] = fd;
+
+       break;
+     }
+
+
+
+
+     case 0x0D : { //ps
+       // snapshot the status and accounting of (at most n) processes, the idle task included
+       procinfo_t* x = ( procinfo_t* )( ctx->gpr[0] );
+       int         m = ( int         )( ctx->gpr[1] ), r = 0;
+
+       m = ( m < ( PROC_MAX + 1 ) ) ? m : ( PROC_MAX + 1 );
+
+       if (m > 0 && !space_write( current->space, ( uint32_t )( x ), m * sizeof( procinfo_t ) )) {
+         ctx->gpr[0] = -1;
+         break;
+       }
+
+       // anything TERMINATED still on proc_all is a zombie, i.e., a process yet to be waited for or a thread yet to be joined, so is reported as such
+       for (pcb_t* p = &idle; p != NULL && r<m; p = ( p == &idle ) ? proc_all : p->all_next) {
+         x[ r ].pid    = p->pid;
+         x[ r ].status = ( p == &idle ) ? STATUS_READY : p->status; // idle is never the caller
+         x[ r ].nice   = p->nice;
+         x[ r ].acct   = p->acct;
+         r++;
+       }
+
+       ctx->gpr[0] = r;
+       break;
+     }
+
+     case 0x0E : { //getpid
+       ctx->gpr[0] = current->pid;
+       break;
+     }
+
+     case 0x0F : { //irq_latency
+       // copy (at most n of) the most recent TIMER0 entry latencies, in cycles
+       uint32_t* x = ( uint32_t* )( ctx->gpr[0] );
+       int       m = ( int       )( ctx->gpr[1] );
+
+       int r = ( irq_latency_count < IRQ_LATENCY_MAX ) ? irq_latency_count : IRQ_LATENCY_MAX;
+       r = ( r < m ) ? r : m;
+
+       if (r > 0 && !space_write( current->space, ( uint32_t )( x ), r * sizeof( uint32_t ) )) {
+         ctx->gpr[0] = -1;
+         break;
+       }
+
+       for (int i=0;i<r;i++) {
+         x[ i ] = irq_latency[ ( irq_latency_count - r + i ) % IRQ_LATENCY_MAX ];
+       }
+
+       ctx->gpr[0] = r;
+       break;
+     }
+
+     case 0x10 : { //klog_level
+       // set the run-time kernel log level to x (if x >= 0), returning the previous one
+       int x = ( int )( ctx->gpr[0] );
+
+       ctx->gpr[0] = klog_level;
+
+       if (x >= 0) {
+         klog_level = x;
+       }
+       break;
+     }
+
+     case 0x11 : { //kmem
+       // snapshot the usage of (at most n of) the page allocator and slab caches
+       kmeminfo_t* x = ( kmeminfo_t* )( ctx->gpr[0] );
+       int         m = ( int         )( ctx->gpr[1] );
+
+       m = ( m < ( kmem_count + 1 ) ) ? m : ( kmem_count + 1 ); // so m * sizeof( kmeminfo_t ) cannot wrap round
+
+       if (m > 0 && !space_write( current->space, ( uint32_t )( x ), m * sizeof( kmeminfo_t ) )) {
+         ctx->gpr[0] = -1;
+         break;
+       }
+
+       ctx->gpr[0] = kmem_stats( x, m );
+       break;
+     }
+
+     case 0x12 : { //sbrk
+       // move the break by n bytes, returning the old one
+       int32_t  n = ( int32_t  )( ctx->gpr[0] );
+       uint32_t r = space_sbrk( current->space, n );
+
+       ctx->gpr[0] = ( r != 0 ) ? r : -1;
+       break;
+     }
+
+     case 0x13 : { //mmap
+       // map a region of n bytes (rounded up to whole pages), returning its address
+       uint32_t n = ( uint32_t )( ctx->gpr[0] );
+       uint32_t r = space_mmap( current->space, n );
+
+       ctx->gpr[0] = ( r != 0 ) ? r : -1;
+       break;
+     }
+
+     case 0x14 : { //munmap
+       // unmap the n bytes (rounded up to whole pages) from x, as mapped by mmap
+       uint32_t x = ( uint32_t )( ctx->gpr[0] );
+       uint32_t n = ( uint32_t )( ctx->gpr[1] );
+
+       ctx->gpr[0] = space_munmap( current->space, x, n ) ? 0 : -1;
+       break;
+     }
+
+     case 0x15 : { //spawn
+       // create a process executing from x, with nice value y and a stack of n bytes, returning its PID
+       uint32_t x = ( uint32_t )( ctx->gpr[0] );
+       int      y = ( int      )( ctx->gpr[1] );
+       uint32_t n = ( ctx->gpr[2] == 0 ) ? STACK_DEFAULT : PAGE_ROUND( ctx->gpr[2] );
+
+       y = ( y < NICE_MIN ) ? NICE_MIN : ( y > NICE_MAX ) ? NICE_MAX : y;
+
+       pcb_t* p = ( x != 0 && n != 0 && n <= STACK_MAX ) ? proc_create( x, y, n ) : NULL;
+
+       if (p == NULL) {
+         ctx->gpr[0] = -1;
+         break;
+       }
+
+       child_link( pid_find( current->tgid ), p );
+       rq_enqueue( active, p );
+
+       trace( TRACE_SPAWN, current->pid, p->pid );
+
+       ctx->gpr[0] = p->pid;
+       break;
+     }
+
+     case 0x16 : { //thread
+       // create a thread in the executing process, executing from x with argument y and a stack of n bytes, returning its PID
+       uint32_t x = ( uint32_t )( ctx->gpr[0] );
+       uint32_t y = ( uint32_t )( ctx->gpr[1] );
+       uint32_t n = ( ctx->gpr[2] == 0 ) ? STACK_DEFAULT : PAGE_ROUND( ctx->gpr[2] );
+
+       pcb_t* p = ( x != 0 && n != 0 && n <= STACK_MAX ) ? proc_thread( current, x, y, n ) : NULL;
+
+       if (p == NULL) {
+         ctx->gpr[0] = -1;
+         break;
+       }
+
+       rq_enqueue( active, p );
+
+       trace( TRACE_THREAD, current->pid, p->pid );
+
+       ctx->gpr[0] = p->pid;
+       break;
+     }
+
+     case 0x17 : { //thread_exit
+       // terminate the executing thread with value x, for thread_join; the last thread to do so terminates the process
+       trace( TRACE_EXIT, current->pid, ctx->gpr[0] );
+
+       if (current->space->users == 1) {
+         proc_exit( current, 0 );
+       }
+       else { //keep the PCB, as a zombie, until joined
+         sched_remove( current );
+         space_thread_free( current->space, current->stack_top );
+         space_free( current->space );
+
+         current->space  = NULL;
+         current->retval = ctx->gpr[0];
+         current->status = STATUS_TERMINATED;
+         waitq_wake( &current->joiners );
+       }
+
+       priority_scheduler();
+       break;
+     }
+
+     case 0x18 : { //thread_join
+       // wait for thread t, in the executing process, to exit, then store the value it exited with in *x (unless x = NULL)
+       pid_t    t = ( pid_t    )( ctx->gpr[0] );
+       uint32_t x = ( uint32_t )( ctx->gpr[1] );
+       pcb_t*   p = pid_find( t );
+
+       if (p == NULL || p == current || p->tgid != current->tgid || p->pid == p->tgid) { //the first thread lasts as long as the process
+         ctx->gpr[0] = -1;
+         break;
+       }
+       if (p->status != STATUS_TERMINATED) {
+         ctx->pc -= 4; //reissue the system call once p exits
+         waitq_block( &p->joiners );
+         break;
+       }
+       if (x != 0 && !space_write( current->space, x, sizeof( uint32_t ) )) {
+         ctx->gpr[0] = -1;
+         break;
+       }
+
+       if (x != 0) {
+         *( uint32_t* )( x ) = p->retval;
+       }
+
+       pcb_release( p );
+
+       ctx->gpr[0] = 0;
+       break;
+     }
+
+     case 0x19 : { //futex_wait
+       // wait on the futex at x, iff. it still has the value y
+       uint32_t x = ( uint32_t )( ctx->gpr[0] );
+       uint32_t y = ( uint32_t )( ctx->gpr[1] );
+
+       if ((x & 3) != 0 || !space_read( current->space, x, sizeof( uint32_t ) ) || *( volatile uint32_t* )( x ) != y) {
+         ctx->gpr[0] = -1; //changed already, so no need to wait
+         break;
+       }
+
+       current->futex = x;
+       ctx->gpr[0]    = 0;  //not reissued once woken, unlike a blocking read, since the value may not have changed
+       waitq_block( futex_queue( futex_space( x ), x ) );
+       break;
+     }
+
+     case 0x1A : { //futex_wake
+       // wake at most n of the processes waiting on the futex at x, returning how many were
+       uint32_t    x = ( uint32_t )( ctx->gpr[0] );
+       int         n = ( int      )( ctx->gpr[1] );
+       mm_space_t* s = futex_space( x );
+       int         r = 0;
+
+       for( pcb_t* p = futex_queue( s, x )->head, * q; p != NULL && r < n; p = q ) {
+         q = p->next;
 
+         if (p->futex == x && ( s == NULL || p->space == s )) {
+           waitq_remove( p ); sched_wake( p ); r++;
+         }
+       }
+
+       ctx->gpr[0] = r;
        break;
      }
 
+     case 0x1B : { //waitpid
+       // wait for child x (or, if x = -1, any child) to exit, then store its exit status in *y (unless y = NULL) and return its PID
+       pid_t    x = ( pid_t    )( ctx->gpr[0] );
+       uint32_t y = ( uint32_t )( ctx->gpr[1] );
+       int      z = ( int      )( ctx->gpr[2] );
+       pcb_t*   l = pid_find( current->tgid );
+       pcb_t*   c = NULL;
+
+       if (x == -1) {
+         for( c = l->children; c != NULL && !c->exited; c = c->sib_next ) {
+           // find the first that has exited, if any
+         }
+       }
+       else if ((c = pid_find( x )) == NULL || c->parent != l) {
+         c = NULL; l = NULL; //not a child
+       }
+
+       if (l == NULL || ( x == -1 && l->children == NULL )) {
+         ctx->gpr[0] = -1; //no such child, so nothing to wait for
+         break;
+       }
+       if (c == NULL || !c->exited) {
+         if (z & WNOHANG) {
+           ctx->gpr[0] = 0;
+           break;
+         }
+
+         ctx->pc -= 4; //reissue the system call once a child exits
+         waitq_block( &l->waiters );
+         break;
+       }
+       if (y != 0 && !space_write( current->space, y, sizeof( int ) )) {
+         ctx->gpr[0] = -1;
+         break;
+       }
+
+       if (y != 0) {
+         *( int* )( y ) = c->exit_status;
+       }
+
+       ctx->gpr[0] = c->pid;
+       pcb_release( c );
+       break;
+     }
 
+     case 0x1C : { //close
+       // drop the executing process' hold(s) on pipe fd, which is freed once nothing holds it
+       int fd = ( int )( ctx->gpr[0] );
 
+       ctx->gpr[0] = ( pipe_fd( fd ) != NULL && pipe_drop( fd, current->tgid ) ) ? 0 : -1;
+       break;
+     }
 
     default   : { // 0x?? => unknown/unsupported
       break;
     }
   }
 
+  trace( TRACE_SVC_EXIT, caller, id );
+
+  kernel_exit();
+
+  return;
+}
+
+/* An abort in USR mode is either a write to a copy-on-write page, which
+ * is resolved by copying it then retrying the write, or means the process
+ * accessed memory it has no access to, e.g., overflowed its stack into the
+ * unmapped page below it: the process is terminated, as if it had been
+ * killed, but nothing else is affected.  An abort in the kernel itself is a bug, so the kernel just
+ * reports it (directly, since the idle task will never get to drain the
+ * log) then halts.
+ */
+
+void panic( const char* x, uint32_t y ) {
+  for( ; *x != '\x00'; x++ ) {
+    PL011_putc( UART0, *x, true );
+  }
+  for( int i = 28; i >= 0; i -= 4 ) {
+    PL011_putc( UART0, "0123456789ABCDEF"[ ( y >> i ) & 0xF ], true );
+  }
+
+  PL011_putc( UART0, '\n', true );
+
+  while( 1 ) {
+    asm volatile( "wfi" );
+  }
+}
+
+void hilevel_handler_abt( ctx_t* ctx, uint32_t id ) {
+  uint32_t addr, status;
+
+  mm_fault( id == 1, &addr, &status );
+
+  if( ( ctx->cpsr & 0x1F ) != 0x10 || current == &idle ) {
+    panic( "kernel abort at address 0x", addr );
+  }
+
+  acct_enter();
+
+  // a permission fault (FS = 01111) on a write (WnR = 1) may just be to a copy-on-write page
+  bool write = ( id == 1 ) && ( ( status & 0x0000040F ) == 0x0000000F ) && ( ( status & 0x00000800 ) != 0 );
+
+  if( write && space_fault( current->space, addr ) ) {
+    kernel_exit();
+
+    return;
+  }
+
+  trace( TRACE_FAULT, current->pid, addr >> PAGE_SHIFT );
+  klog_puts( KLOG_ERROR, "segmentation fault\n" );
+
+  proc_exit( current, EXIT_KILLED );
+  priority_scheduler();
+
+  kernel_exit();
+
   return;
 }
@@ -13,6 +13,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 // Include functionality relating to the platform.
 
@@ -24,6 +25,10 @@
 
 #include "lolevel.h"
 #include     "int.h"
+#include   "timer.h"
+#include      "mm.h"
+#include    "kmem.h"
+#include     "tls.h"
 
 /* The kernel source code is made simpler and more consistent by using
  * some human-readable type definitions:
@@ -35,7 +40,9 @@
  * - a type that captures each component of an execution context (i.e.,
  *   processor state) in a compatible order wrt. the low-level handler
  *   preservation and restoration prologue and epilogue, and
- * - a type that captures a process PCB.
+ * - a type that captures a process PCB,
+ * - a type that captures a multi-level run queue of READY processes, and
+ * - a type that captures a queue of WAITING processes.
  */
 
 typedef int pid_t;
@@ -52,19 +59,208 @@ typedef struct {
   uint32_t cpsr, pc, gpr[ 13 ], sp, lr;
 } ctx_t;
 
+/* Note that ctx *must* be the first field: the low-level handlers locate
+ * the context to preserve or restore by dereferencing current directly.
+ *
+ * Each process has a static priority, i.e., its nice value, which fixes
+ * both a base run queue level and the length of its slice; the level it
+ * is actually queued at is then adjusted by an interactivity score, which
+ * rises each time the process gives up the processor voluntarily and
+ * falls each time it is preempted at the end of a slice.
+ */
+
+#define NICE_MIN        ( -20 )
+#define NICE_MAX        (  19 )
+
+#define INTERACTIVE_MAX (  10 )
+
+/* PCBs are allocated from a slab cache, so the number of processes is
+ * limited by memory rather than by a table size.  Each process has its own
+ * address space, in which its stack is mapped just below STACK_TOP: this
+ * is STACK_DEFAULT bytes unless requested otherwise (via exec), up to at
+ * most STACK_MAX bytes, which must fit in a slot of the stack window (see
+ * mm.h) and leave room for a guard page.
+ */
+
+#define STACK_DEFAULT   ( 0x00001000 )
+#define STACK_MAX       ( 0x00010000 )
+
+/* A real-time process additionally has an EDF reservation: times are in
+ * clock ticks, with release and key absolute, and the rest relative.
+ */
+
+typedef struct {
+      bool on;        // real-time iff. true
+  uint32_t period;
+  uint32_t budget;
+  uint32_t deadline;
+  uint32_t release;   // release time of current job
+  uint32_t key;       // sort key, i.e., absolute deadline when READY or next release when WAITING
+  uint32_t remaining; // budget left for current job
+      bool pending;   // current job not yet complete
+      bool queued;    // in rt_ready (if READY) or rt_waiting (if WAITING)
+  uint32_t misses;    // number of deadlines missed
+} rt_t;
+
+/* Each process is charged for the time it spends executing, in USR mode
+ * or in the kernel on its behalf, and counts how often it gave up the
+ * processor: voluntarily, i.e., because it could no longer execute (e.g.,
+ * it blocked), or involuntarily, i.e., even though it could have carried
+ * on (as in Linux, this includes calling yield).
+ */
+
 typedef struct {
+  uint32_t utime;     // clock ticks executing in USR mode
+  uint32_t stime;     // clock ticks executing in the kernel
+  uint32_t nvcsw;     //   voluntary context switches
+  uint32_t nivcsw;    // involuntary context switches
+  uint32_t syscalls;  // system calls made
+} acct_t;
+
+/* A wait queue is a FIFO of processes WAITING for some event (e.g., for
+ * there to be something to read), linked via the same prev and next
+ * fields as a run queue: a process is never in both at once.
+ */
+
+typedef struct waitq_s {
+  struct pcb_s* head;
+  struct pcb_s* tail;
+} waitq_t;
+
+/* A process may have several threads, each with a PCB (and so a PID) of
+ * its own, which are scheduled individually but share one address space
+ * and so on: the threads of a process form a group, identified by the PID
+ * of the first one, i.e., the process itself.  Each thread has its own
+ * stack, in a slot of the stack window (see mm.h), and so its own thread-
+ * local area.  A thread that exits is kept, as a zombie (i.e., TERMINATED
+ * but still with a PID), until some other thread in the group joins it
+ * and so collects the value it exited with.
+ *
+ * Likewise, once a process exits, its first thread is kept as a zombie
+ * until the parent, i.e., the process that created it (via fork or spawn),
+ * collects its exit status via waitpid; if it has no parent (e.g., the
+ * parent has itself exited), it is freed straight away.  Each process
+ * therefore keeps a list of its children, and its first thread lasts as
+ * long as the process does (so cannot be joined).
+ */
+
+#define EXIT_KILLED     ( -1 ) // exit status of a process that was killed, or that faulted
+#define WNOHANG         (  1 ) // a waitpid flag: return 0 rather than wait, if the child(ren) have yet to exit
+
+typedef struct pcb_s {
+     ctx_t    ctx;
      pid_t    pid;
+     pid_t    tgid;      // thread group, i.e., PID of the process the thread belongs to
+  struct pcb_s* all_prev; // links in the list of every process, in PID order
+  struct pcb_s* all_next;
   status_t status;
-     ctx_t    ctx;
-     int basePriority;  /////////////////////////////////////////
-     int age;
+     int    nice;        // static priority, NICE_MIN ... NICE_MAX
+  uint32_t  quantum;     // slice length, in clock ticks
+     int    interactive; // interactivity score, 0 ... INTERACTIVE_MAX
+     int    priority;    // run queue level, 0 being the highest
+  struct runqueue_s* queue; // run queue the process is in, NULL iff. not queued
+  struct pcb_s* prev;    // intrusive run queue links
+  struct pcb_s* next;
+      rt_t    rt;
+  ktimer_t    timer;     // wakes the process from sleep
+  struct waitq_s* waitq; // wait queue the process is in, NULL iff. not waiting on one
+  uint32_t    futex;     // address waited on, iff. waiting in futex_wait
+  uint32_t    tls;       // address of thread-local area, loaded into TPIDRURO
+  mm_space_t* space;     // address space, i.e., page tables mapping the stack, or NULL once a thread exits
+  uint32_t    stack_size;
+  uint32_t    stack_top; // top of the stack slot, i.e., STACK_TOP unless it is a thread
+  uint32_t    retval;    // value the thread exited with
+   waitq_t    joiners;   // threads waiting to join this one
+  struct pcb_s* parent;  // (first thread of the) process that created this one, or NULL if none
+  struct pcb_s* children; // first child, iff. this is the first thread of a process
+  struct pcb_s* sib_prev; // links in the parent's list of children
+  struct pcb_s* sib_next;
+      bool    exited;    // true iff. the whole process has exited, so exit_status is valid
+       int    exit_status;
+   waitq_t    waiters;   // threads of this process waiting for a child to exit
+    acct_t    acct;
 } pcb_t;
 
+/* A run queue keeps one FIFO of READY processes per priority level, plus
+ * a bitmap in which bit ( 31 - l ) is set iff. level l is non-empty: this
+ * means clz of the bitmap yields the highest non-empty level, so enqueue,
+ * dequeue and pick-next are all constant time.
+ */
+
+#define RQ_LEVELS ( 32 )
+
+typedef struct runqueue_s {
+  uint32_t bitmap;
+  pcb_t*   head[ RQ_LEVELS ];
+  pcb_t*   tail[ RQ_LEVELS ];
+} runqueue_t;
+
+// block the executing process on wait queue q, then reschedule
+extern void waitq_block( waitq_t* q );
+// wake every process on wait queue q
+extern void waitq_wake( waitq_t* q );
+
+/* A snapshot of a process' status and accounting, as returned by the ps
+ * system call: this must match procinfo_t in user/libc.h.
+ */
+
+typedef struct {
+     pid_t pid;
+       int status;    // a status_t, but of fixed size
+       int nice;
+    acct_t acct;
+} procinfo_t;
+
+/* Per QEMU, which clocks the cycle counter at 1GHz and the SP804 timers
+ * at 1MHz; these may need calibration on other platforms.
+ */
+
+#define CPU_HZ          ( 1000000000 )
+#define CLOCK_HZ        (    1000000 )
+
+// read the free-running clock, in 1MHz ticks since reset
+extern uint32_t clock_now();
+// read the cycle counter, at CPU_HZ (USR mode can read it too)
+extern uint32_t cycles_now();
+
+/* Each pipe buffers data in a ring, much like a tty: the indices are
+ * free-running, so the ring holds ( head - tail ) bytes, which is at most
+ * PIPE_SIZE (a power of 2).  A reader waits on rd_wait while the pipe is
+ * empty, and a writer waits on wr_wait while the pipe is full.
+ *
+ * Pipes are allocated from a slab cache, and file descriptors 4 and up map
+ * to them (see hilevel.c); 0 ... 3 are the ttys.  Each is held by its owner
+ * (the process that created it) and the parent and child that open it, or
+ * -1 for any that has closed it, and freed once there are none left.
+ */
+
+#define PIPE_SIZE ( 512 )
+
 typedef struct {
+  pid_t owner;
   pid_t parent;
   pid_t child;
   uint32_t data;
   bool inUse;
+  uint8_t  buf[ PIPE_SIZE ];
+  uint32_t head;             // next byte written by write
+  uint32_t tail;             // next byte read    by read
+  waitq_t  rd_wait;          // processes waiting for something to read
+  waitq_t  wr_wait;          // processes waiting for space to write
 } pipe_t;
 
+/* A futex is just a word of user memory, which a process can wait on (iff.
+ * it still has an expected value) until some other process wakes it: the
+ * word itself is only ever updated in USR mode (e.g., via LDREX/STREX), so
+ * the kernel is only involved once there is contention.  Waiters are held
+ * in FUTEX_BUCKETS wait queues, hashed by address, so a wake only has to
+ * look at those that might be waiting on the same word.  An address below
+ * 32MiB means different memory in different address spaces, so there it is
+ * qualified by the address space (i.e., shared by threads, not processes);
+ * above that, i.e., in the kernel image, it is shared by every process.
+ */
+
+#define FUTEX_BITS    ( 6 )
+#define FUTEX_BUCKETS ( 1 << FUTEX_BITS )
+
 #endif
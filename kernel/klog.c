@@ -0,0 +1,55 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "klog.h"
+#include  "tty.h"
+
+char              klog_ring[ KLOG_SIZE ];
+
+int               klog_level   = KLOG_LEVEL;
+volatile uint32_t klog_head    = 0; // next byte written by the kernel
+volatile uint32_t klog_tail    = 0; // next byte sent    by the idle task
+uint32_t          klog_dropped = 0;
+
+void klog_append( char x ) {
+  uint32_t h = klog_head;
+
+  if( ( h - klog_tail ) >= KLOG_SIZE ) {
+    klog_dropped++; return;
+  }
+
+  klog_ring[ h & ( KLOG_SIZE - 1 ) ] = x;
+
+  asm volatile( "" : : : "memory" ); // write the byte before publishing it
+
+  klog_head = h + 1;
+}
+
+/* Move as much of the ring as fits into the transmit ring of tty[ 0 ], so
+ * log output reaches UART0 via the same path as process output, and is
+ * only ever interleaved with it between one write and the next, never in
+ * the middle of one.  Once that ring is full, what is left waits for the
+ * transmit interrupt to make space, and the kernel to call this again.
+ */
+
+void klog_drain() {
+  uint32_t t = klog_tail, h = klog_head;
+
+  while( t != h ) {
+    uint32_t i = t & ( KLOG_SIZE - 1 );
+    uint32_t n = ( ( h - t ) < ( KLOG_SIZE - i ) ) ? ( h - t ) : ( KLOG_SIZE - i ); // up to the end of the ring
+    uint32_t r = tty_write( &tty[ 0 ], ( uint8_t* )( &klog_ring[ i ] ), n );
+
+    t += r;
+
+    if( r < n ) {
+      break;
+    }
+  }
+
+  klog_tail = t;
+}
@@ -0,0 +1,58 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __KLOG_H
+#define __KLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "PL011.h"
+
+/* Kernel log output is deferred: logging just appends to an in-memory ring,
+ * which is drained into the transmit ring of tty[ 0 ] (i.e., UART0) only
+ * when the kernel is about to resume the idle task, i.e., when there is
+ * nothing else to do, so the kernel never waits for the UART, and UART0
+ * has a single writer.  If the ring is full, output is dropped (and
+ * counted in klog_dropped).
+ *
+ * Each message has a level, and is only logged if that level is at most
+ *
+ * - KLOG_LEVEL, fixed at compile-time (so anything above it costs nothing
+ *   at all), and
+ * - klog_level, which can be changed at run-time (via the klog_level
+ *   system call).
+ */
+
+#define KLOG_ERROR  ( 0 )
+#define KLOG_WARN   ( 1 )
+#define KLOG_INFO   ( 2 )
+#define KLOG_DEBUG  ( 3 )
+
+#ifndef KLOG_LEVEL
+#define KLOG_LEVEL  ( KLOG_DEBUG )
+#endif
+
+#define KLOG_SIZE   ( 1024 ) // a power of 2
+
+extern          int      klog_level;
+extern volatile uint32_t klog_head;
+extern volatile uint32_t klog_tail;
+extern          uint32_t klog_dropped;
+
+// log character x at level l
+#define klog_putc( l, x ) do { if( ( ( l ) <= KLOG_LEVEL ) && ( ( l ) <= klog_level ) ) { klog_append( x ); } } while( 0 )
+// log string  x at level l
+#define klog_puts( l, x ) do { if( ( ( l ) <= KLOG_LEVEL ) && ( ( l ) <= klog_level ) ) { for( const char* p = ( x ); *p != '\x00'; p++ ) { klog_append( *p ); } } } while( 0 )
+
+// append x to the ring, regardless of level
+extern void klog_append( char x );
+// move as much of the ring as possible into the transmit ring of tty[ 0 ]
+extern void klog_drain();
+
+#endif
@@ -0,0 +1,175 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "kmem.h"
+
+#define KMEM_ALIGN( x ) ( ( ( x ) + 7 ) & ~7 )
+
+kmem_cache_t* kmem_caches = NULL;
+int           kmem_count  = 0;
+
+void kmem_cache_init( kmem_cache_t* c, const char* name, size_t size, void (*ctor)( void* x ) ) {
+  memset( c, 0, sizeof( kmem_cache_t ) );
+
+  c->name = name;
+  c->size = KMEM_ALIGN( ( size < sizeof( void* ) ) ? sizeof( void* ) : size );
+  c->ctor = ctor;
+
+  for( c->order = 0; c->order < KMEM_ORDER_MAX; c->order++ ) {
+    uint32_t n = ( PAGE_SIZE << c->order ) - KMEM_ALIGN( sizeof( kmem_slab_t ) );
+
+    if( n >= c->size && ( n % c->size ) <= ( ( PAGE_SIZE << c->order ) / 8 ) ) {
+      break;
+    }
+  }
+
+  c->count = ( ( PAGE_SIZE << c->order ) - KMEM_ALIGN( sizeof( kmem_slab_t ) ) ) / c->size;
+
+  c->next     = kmem_caches;
+  kmem_caches = c;
+  kmem_count++;
+}
+
+void kmem_push( kmem_slab_t** list, kmem_slab_t* s ) {
+  s->prev = NULL;
+  s->next = *list;
+
+  if( *list != NULL ) {
+    ( *list )->prev = s;
+  }
+
+  *list = s;
+}
+
+void kmem_unlink( kmem_slab_t** list, kmem_slab_t* s ) {
+  if( s->prev != NULL ) {
+    s->prev->next = s->next;
+  }
+  else {
+    *list         = s->next;
+  }
+  if( s->next != NULL ) {
+    s->next->prev = s->prev;
+  }
+
+  s->prev = NULL;
+  s->next = NULL;
+}
+
+/* Carve a new slab for c, threading every object onto its free list.
+ */
+
+kmem_slab_t* kmem_grow( kmem_cache_t* c ) {
+  kmem_slab_t* s = ( kmem_slab_t* )( pages_alloc( c->order ) );
+
+  if( s == NULL ) {
+    return NULL;
+  }
+
+  uint8_t* x = ( uint8_t* )( s ) + KMEM_ALIGN( sizeof( kmem_slab_t ) );
+
+  s->cache = c;
+  s->free  = NULL;
+  s->inuse = 0;
+
+  for( int i = c->count - 1; i >= 0; i-- ) { // so objects are handed out lowest first
+    *( void** )( x + ( i * c->size ) ) = s->free;
+    s->free = x + ( i * c->size );
+  }
+
+  c->slabs++;
+
+  return s;
+}
+
+void* kmem_alloc( kmem_cache_t* c ) {
+  kmem_slab_t* s = c->partial;
+
+  c->allocs++;
+
+  if( s == NULL ) {
+    if( c->empty != NULL ) {
+      s = c->empty; c->empty = NULL;
+    }
+    else if( ( s = kmem_grow( c ) ) == NULL ) {
+      c->fails++;
+      return NULL;
+    }
+
+    kmem_push( &c->partial, s );
+  }
+
+  void* x = s->free;
+
+  s->free = *( void** )( x );
+  s->inuse++;
+  c->inuse++;
+
+  if( s->free == NULL ) {
+    kmem_unlink( &c->partial, s ); // now full
+  }
+
+  if( c->ctor != NULL ) {
+    c->ctor( x );
+  }
+
+  return x;
+}
+
+void kmem_free( kmem_cache_t* c, void* x ) {
+  kmem_slab_t* s = ( kmem_slab_t* )( ( uint32_t )( x ) & ~( ( PAGE_SIZE << c->order ) - 1 ) );
+
+  if( s->free == NULL ) {
+    kmem_push( &c->partial, s ); // was full
+  }
+
+  *( void** )( x ) = s->free;
+  s->free = x;
+  s->inuse--;
+  c->inuse--;
+
+  if( s->inuse != 0 ) {
+    return;
+  }
+
+  kmem_unlink( &c->partial, s );
+
+  if( c->empty == NULL ) {
+    c->empty = s;
+  }
+  else {
+    pages_free( ( uint32_t )( s ), c->order ); c->slabs--;
+  }
+}
+
+int kmem_stats( kmeminfo_t* x, int n ) {
+  int r = 0;
+
+  if( r < n ) {
+    strncpy( x[ r ].name, "page",  KMEM_NAME - 1 ); x[ r ].name[ KMEM_NAME - 1 ] = '\x00';
+    x[ r ].size   = PAGE_SIZE;
+    x[ r ].inuse  = page_used;
+    x[ r ].total  = POOL_PAGES;
+    x[ r ].slabs  = pages_largest();
+    x[ r ].allocs = page_allocs;
+    x[ r ].fails  = page_fails;
+    r++;
+  }
+
+  for( kmem_cache_t* c = kmem_caches; c != NULL && r < n; c = c->next ) {
+    strncpy( x[ r ].name, c->name, KMEM_NAME - 1 ); x[ r ].name[ KMEM_NAME - 1 ] = '\x00';
+    x[ r ].size   = c->size;
+    x[ r ].inuse  = c->inuse;
+    x[ r ].total  = c->slabs * c->count;
+    x[ r ].slabs  = c->slabs;
+    x[ r ].allocs = c->allocs;
+    x[ r ].fails  = c->fails;
+    r++;
+  }
+
+  return r;
+}
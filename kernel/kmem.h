@@ -0,0 +1,96 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __KMEM_H
+#define __KMEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mm.h"
+
+/* Kernel objects (e.g., PCBs or pipes) are allocated from typed caches,
+ * per
+ *
+ * J. Bonwick. The Slab Allocator: An Object-Caching Kernel Memory
+ * Allocator. In USENIX Summer Technical Conference, 87--98, 1994.
+ *
+ * Each cache carves blocks of pages from the buddy allocator (see mm.h)
+ * into slabs of equal-sized objects: a slab starts with a header, which
+ * records how many of its objects are allocated and heads a list of those
+ * that are free, and is aligned to its own size, so the slab an object
+ * belongs to is found by masking the object's address.  A cache keeps
+ * slabs with some objects free on a partial list, so allocation just pops
+ * an object from the first one; full slabs are on no list at all, and at
+ * most one empty slab is kept (so a cache does not thrash the buddy
+ * allocator as objects come and go), the rest being freed.  Allocating and
+ * freeing an object are therefore constant time, bar the occasional call
+ * to the buddy allocator.
+ *
+ * The slab size is the smallest block (of at most 2^KMEM_ORDER_MAX pages)
+ * that wastes at most 1/8 of itself, and a cache has an optional
+ * constructor, invoked on each object as it is allocated, so callers
+ * always get an object in a known state.
+ */
+
+#define KMEM_ORDER_MAX ( 3 )
+
+typedef struct kmem_slab_s {
+  struct kmem_cache_s* cache;
+  struct kmem_slab_s*  prev;  // partial list links
+  struct kmem_slab_s*  next;
+  void*                free;  // first free object, NULL iff. full
+  uint32_t             inuse; // objects allocated
+} kmem_slab_t;
+
+typedef struct kmem_cache_s {
+  const char*  name;
+  uint32_t     size;          // object size, in bytes, rounded up to a multiple of 8
+  uint32_t     order;         // slab size is PAGE_SIZE << order
+  uint32_t     count;         // objects per slab
+  void       (*ctor)( void* x );
+  kmem_slab_t* partial;       // slabs with some, but not all, objects allocated
+  kmem_slab_t* empty;         // a slab with no objects allocated, or NULL
+  struct kmem_cache_s* next;  // every cache is on kmem_caches, for kmem_stats
+  uint32_t     slabs;         // slabs allocated
+  uint32_t     inuse;         // objects allocated
+  uint32_t     allocs;        // calls to kmem_alloc
+  uint32_t     fails;         // calls to kmem_alloc that failed
+} kmem_cache_t;
+
+/* A snapshot of the usage of a cache, as returned by the kmem system call:
+ * this must match kmeminfo_t in user/libc.h.  The first one describes the
+ * buddy allocator, with an object being a page, and slabs the number of
+ * pages in the largest free block.
+ */
+
+#define KMEM_NAME ( 8 )
+
+typedef struct {
+      char name[ KMEM_NAME ];
+  uint32_t size;
+  uint32_t inuse;
+  uint32_t total;
+  uint32_t slabs;
+  uint32_t allocs;
+  uint32_t fails;
+} kmeminfo_t;
+
+extern int   kmem_count; // caches initialised, so kmem_stats returns at most kmem_count + 1 snapshots
+
+// initialise cache c, of objects of size bytes, with constructor ctor (or NULL)
+extern void  kmem_cache_init( kmem_cache_t* c, const char* name, size_t size, void (*ctor)( void* x ) );
+// allocate an object from cache c, or return NULL if impossible
+extern void* kmem_alloc( kmem_cache_t* c );
+// free object x, as allocated from cache c
+extern void  kmem_free( kmem_cache_t* c, void* x );
+// snapshot at most n caches (the buddy allocator first) into x; return the number snapshot
+extern int   kmem_stats( kmeminfo_t* x, int n );
+
+#endif
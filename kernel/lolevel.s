@@ -8,6 +8,14 @@
 /* Each of the following is a low-level interrupt handler: each one is
  * tasked with handling a different interrupt type, and acts as a sort
  * of wrapper around a high-level, C-based handler.
+ *
+ * Rather than building a context on the stack, the prologue preserves
+ * the USR mode registers directly into the PCB that current points to,
+ * and the epilogue restores them from whichever PCB current points to
+ * once the high-level handler returns: switching between processes is
+ * therefore just a matter of updating current.  Note that the kernel is
+ * not re-entrant, so each mode stack is empty whenever USR mode code is
+ * executing, and can simply be reset by the epilogue.
  */
 
  /*stmfd sp!, { r0-r3, ip, lr }  @ save    caller-save registers*/
@@ -15,57 +23,134 @@
 .global lolevel_handler_rst
 .global lolevel_handler_svc
 .global lolevel_handler_irq
+.global lolevel_handler_pab
+.global lolevel_handler_dab
 
 lolevel_handler_rst: bl    int_init                @ initialise interrupt vector table
 
                      msr   cpsr, #0xD2             @ enter IRQ mode with IRQ and FIQ interrupts disabled
                      ldr   sp, =tos_irq            @ initialise IRQ mode stack
 
+                     msr   cpsr, #0xD7             @ enter ABT mode with IRQ and FIQ interrupts disabled
+                     ldr   sp, =tos_abt            @ initialise ABT mode stack
+
                      msr   cpsr, #0xD3             @ enter SVC mode with IRQ and FIQ interrupts disabled
                      ldr   sp, =tos_svc            @ initialise SVC mode stack
 
-                     sub   sp, sp, #68             @ initialise dummy context
-
-                     mov   r0, sp                  @ set    high-level C function arg. = SP
                      bl    hilevel_handler_rst     @ invoke high-level C function
 
+                     ldr   sp, =current
+                     ldr   sp, [ sp ]              @ point    SVC mode SP at current->ctx
                      ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
                      msr   spsr, r0                @ move     USR mode        CPSR
                      ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
-                     add   sp, sp, #60             @ update   SVC mode SP
+                     ldr   sp, =tos_svc            @ reset    SVC mode SP
                      movs  pc, lr                  @ return from interrupt
 
 
 
 lolevel_handler_svc: sub   lr, lr, #0              @ correct return address
-                     sub   sp, sp, #60             @ update   SVC mode stack
-                     stmia sp, { r0-r12, sp, lr }^ @ preserve USR registers
-                     mrs   r0, spsr                @ move     USR        CPSR
-                     stmdb sp!, { r0, lr }         @ store    USR PC and CPSR
-
-                     mov   r0, sp                  @ set    high-level C function arg. = SP
+                     str   r0, [ sp, #-4 ]!        @ stash    USR r0
+                     ldr   r0, =current
+                     ldr   r0, [ r0 ]
+                     add   r0, r0, #8              @ point    r0 at current->ctx.gpr
+                     stmia r0, { r0-r12, sp, lr }^ @ preserve USR registers
+                     ldr   r1, [ sp ], #4          @ unstash  USR r0
+                     str   r1, [ r0 ]              @ preserve USR r0
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmdb r0!, { r1, lr }         @ store    USR PC and CPSR
+
+                                                   @ set    high-level C function arg. = current->ctx
                      ldr   r1, [ lr, #-4 ]         @ load                     svc instruction
                      bic   r1, r1, #0xFF000000     @ set    high-level C function arg. = svc immediate
                      bl    hilevel_handler_svc     @ invoke high-level C function
 
+                     ldr   sp, =current
+                     ldr   sp, [ sp ]              @ point    SVC mode SP at current->ctx
                      ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
                      msr   spsr, r0                @ move     USR mode        CPSR
                      ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
-                     add   sp, sp, #60             @ update   SVC mode SP
+                     ldr   sp, =tos_svc            @ reset    SVC mode SP
                      movs  pc, lr                  @ return from interrupt
 
 
-lolevel_handler_irq: sub   lr, lr, #4              @ correct return address
-                     sub   sp, sp, #60             @ update   SVC mode stack
-                     stmia sp, { r0-r12, sp, lr }^ @ preserve USR registers
-                     mrs   r0, spsr                @ move     USR        CPSR
-                     stmdb sp!, { r0, lr }         @ store    USR PC and CPSR
+/* The IRQ handler also reads the cycle counter as soon as it is entered,
+ * before anything is preserved, and hands this to the high-level handler,
+ * so the cost of a context switch can be measured from end to end.
+ */
 
-                     mov   r0, sp                  @ set    high-level C function arg. = SP
+lolevel_handler_irq: sub   lr, lr, #4              @ correct return address
+                     str   r0, [ sp, #-4 ]!        @ stash    USR r0
+                     mrc   p15, 0, r0, c9, c13, 0  @ read     PMCCNTR, i.e., the cycle count on entry
+                     str   r0, [ sp, #-4 ]!        @ stash    cycle count
+                     ldr   r0, =current
+                     ldr   r0, [ r0 ]
+                     add   r0, r0, #8              @ point    r0 at current->ctx.gpr
+                     stmia r0, { r0-r12, sp, lr }^ @ preserve USR registers
+                     ldr   r1, [ sp, #4 ]          @ unstash  USR r0
+                     str   r1, [ r0 ]              @ preserve USR r0
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmdb r0!, { r1, lr }         @ store    USR PC and CPSR
+
+                                                   @ set    high-level C function arg. = current->ctx
+                     ldr   r1, [ sp ], #8          @ set    high-level C function arg. = cycle count
                      bl    hilevel_handler_irq     @ invoke high-level C function
 
+                     ldr   sp, =current
+                     ldr   sp, [ sp ]              @ point    IRQ mode SP at current->ctx
+                     ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
+                     msr   spsr, r0                @ move     USR mode        CPSR
+                     ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
+                     ldr   sp, =tos_irq            @ reset    IRQ mode SP
+                     movs  pc, lr                  @ return from interrupt
+
+/* A pre-fetch or data abort is handled like an interrupt, except that the
+ * return address is corrected differently, and the high-level handler is
+ * also told which of the two it was.
+ */
+
+lolevel_handler_pab: sub   lr, lr, #4              @ correct return address
+                     str   r0, [ sp, #-4 ]!        @ stash    USR r0
+                     ldr   r0, =current
+                     ldr   r0, [ r0 ]
+                     add   r0, r0, #8              @ point    r0 at current->ctx.gpr
+                     stmia r0, { r0-r12, sp, lr }^ @ preserve USR registers
+                     ldr   r1, [ sp ], #4          @ unstash  USR r0
+                     str   r1, [ r0 ]              @ preserve USR r0
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmdb r0!, { r1, lr }         @ store    USR PC and CPSR
+
+                                                   @ set    high-level C function arg. = current->ctx
+                     mov   r1, #0                  @ set    high-level C function arg. = pre-fetch abort
+                     bl    hilevel_handler_abt     @ invoke high-level C function
+
+                     ldr   sp, =current
+                     ldr   sp, [ sp ]              @ point    ABT mode SP at current->ctx
+                     ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
+                     msr   spsr, r0                @ move     USR mode        CPSR
+                     ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
+                     ldr   sp, =tos_abt            @ reset    ABT mode SP
+                     movs  pc, lr                  @ return from interrupt
+
+lolevel_handler_dab: sub   lr, lr, #8              @ correct return address
+                     str   r0, [ sp, #-4 ]!        @ stash    USR r0
+                     ldr   r0, =current
+                     ldr   r0, [ r0 ]
+                     add   r0, r0, #8              @ point    r0 at current->ctx.gpr
+                     stmia r0, { r0-r12, sp, lr }^ @ preserve USR registers
+                     ldr   r1, [ sp ], #4          @ unstash  USR r0
+                     str   r1, [ r0 ]              @ preserve USR r0
+                     mrs   r1, spsr                @ move     USR        CPSR
+                     stmdb r0!, { r1, lr }         @ store    USR PC and CPSR
+
+                                                   @ set    high-level C function arg. = current->ctx
+                     mov   r1, #1                  @ set    high-level C function arg. = data abort
+                     bl    hilevel_handler_abt     @ invoke high-level C function
+
+                     ldr   sp, =current
+                     ldr   sp, [ sp ]              @ point    ABT mode SP at current->ctx
                      ldmia sp!, { r0, lr }         @ load     USR mode PC and CPSR
                      msr   spsr, r0                @ move     USR mode        CPSR
                      ldmia sp, { r0-r12, sp, lr }^ @ restore  USR mode registers
-                     add   sp, sp, #60             @ update   SVC mode SP
+                     ldr   sp, =tos_abt            @ reset    ABT mode SP
                      movs  pc, lr                  @ return from interrupt
@@ -0,0 +1,713 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "mm.h"
+
+/* Section B3.5 of
+ *
+ * http://infocenter.arm.com/help/index.jsp?topic=/com.arm.doc.ddi0406c/index.html
+ *
+ * describes the (short-descriptor) translation table format.  Everything
+ * is in domain 0, which is set to client mode so the AP bits are checked.
+ * The RAM (at 0x70000000, plus the first 1MiB aliased at 0x00000000, where
+ * the vector table lives) is Normal, write-back, write-allocate cacheable
+ * memory, and everything else, i.e., the device windows at 0x10000000 and
+ * 0x1E000000, is Strongly-ordered and never executable (so is not subject
+ * to speculative instruction fetches).  Apart from the vector table and the
+ * pool, all of it is accessible from USR mode, since user programs are
+ * linked into the same image as the kernel.
+ */
+
+#define L1_SECTION_RAM  ( 0x00001C0E ) // section, AP = 011, TEX = 001, C = 1, B = 1
+#define L1_SECTION_KERN ( 0x0000140E ) // section, AP = 001, TEX = 001, C = 1, B = 1
+#define L1_SECTION_DEV  ( 0x00000C12 ) // section, AP = 011, TEX = 000, C = 0, B = 0, XN = 1
+#define L1_COARSE       ( 0x00000001 ) // pointer to a second-level page table
+#define L2_SMALL_KERN   ( 0x0000005E ) // small page, AP = 001 (PL1 only),  TEX = 001, C = 1, B = 1
+#define L2_SMALL_USER   ( 0x0000087E ) // small page, AP = 011 (read/write), TEX = 001, C = 1, B = 1, nG = 1
+#define L2_SMALL_COW    ( 0x00000A7E ) // small page, AP = 111 (read-only),  TEX = 001, C = 1, B = 1, nG = 1
+
+#define TTBCR_N         ( 7 )          // TTBR0 covers the first 2^( 32 - N ) bytes
+
+uint32_t mm_l1[ 4096 ]       __attribute__ ( ( aligned( 0x4000 ) ) ); // global
+uint32_t mm_l2[ POOL_PAGES ] __attribute__ ( ( aligned( 0x0400 ) ) ); // global, for the pool (one table per section)
+uint32_t mm_l1_idle[ 32 ]    __attribute__ ( ( aligned( 0x0080 ) ) ); // per-process, with no stack window
+
+extern uint32_t pool_lo; // image.ld makes this 1MiB aligned, so the pool is a whole number of sections
+extern uint32_t pool_hi;
+
+/* The pool is managed by a buddy allocator, per
+ *
+ * K.C. Knowlton. A Fast Storage Allocator. Communications of the ACM,
+ * 8(10):623--624, 1965.
+ *
+ * A block of order k is 2^k pages, aligned to its own size, so its buddy
+ * (the other half of the block of order k + 1 it was split from) is the
+ * one whose page index differs only in bit k.  There is a free list per
+ * order, plus a bitmap in which bit k is set iff. that list is non-empty,
+ * so allocation finds the smallest large enough free block via ctz then
+ * splits it in halves, and freeing merges a block with its buddy for as
+ * long as that is free too: both take at most BUDDY_ORDERS steps, however
+ * full the pool is.  Since free buddies are always merged, any free block
+ * is as large as its alignment and neighbours allow, and rounding a request
+ * up to a power of 2 wastes less than half of it.
+ *
+ * Free pages are unmapped, so the lists cannot be threaded through the
+ * pages themselves; instead, page_order[ i ] is k iff. page i heads a free
+ * block of order k (or -1 otherwise), and page_prev[ i ] and page_next[ i ]
+ * link it into the list for that order.  page_ref[ i ] counts references
+ * to an allocated page, i.e., the number of address spaces it is mapped
+ * in (or 1, for one that holds page tables or kernel objects).
+ */
+
+#define PAGE_NONE ( -1 )
+
+int16_t  buddy_head[ BUDDY_ORDERS ];
+uint32_t buddy_bitmap;
+
+int8_t   page_order[ POOL_PAGES ];
+int16_t  page_prev[ POOL_PAGES ];
+int16_t  page_next[ POOL_PAGES ];
+uint16_t page_ref[ POOL_PAGES ];
+
+uint32_t page_used   = 0;
+uint32_t page_allocs = 0;
+uint32_t page_fails  = 0;
+
+int page_index( uint32_t x ) {
+  return ( x - ( uint32_t )( &pool_lo ) ) >> PAGE_SHIFT;
+}
+
+void buddy_push( int i, int k ) {
+  page_order[ i ] = k;
+  page_prev[ i ]  = PAGE_NONE;
+  page_next[ i ]  = buddy_head[ k ];
+
+  if( buddy_head[ k ] != PAGE_NONE ) {
+    page_prev[ buddy_head[ k ] ] = i;
+  }
+
+  buddy_head[ k ] = i;
+  buddy_bitmap   |= ( 1 << k );
+}
+
+void buddy_unlink( int i ) {
+  int k = page_order[ i ];
+
+  if( page_prev[ i ] != PAGE_NONE ) {
+    page_next[ page_prev[ i ] ] = page_next[ i ];
+  }
+  else {
+    buddy_head[ k ]             = page_next[ i ];
+  }
+  if( page_next[ i ] != PAGE_NONE ) {
+    page_prev[ page_next[ i ] ] = page_prev[ i ];
+  }
+
+  if( buddy_head[ k ] == PAGE_NONE ) {
+    buddy_bitmap &= ~( 1 << k );
+  }
+
+  page_order[ i ] = PAGE_NONE;
+}
+
+/* After updating a page table, the update has to be made visible to the
+ * table walk, then any stale TLB entries discarded: either those for one
+ * page (which, for a global page, is whatever the ASID), or all of those
+ * for one ASID.  The table walk does not look in the L1 D-cache, so the
+ * former means cleaning whatever lines of the table were written.
+ */
+
+uint32_t mm_line; // smallest D-cache line, in bytes
+
+void mm_clean( void* x, size_t n ) {
+  for( uint32_t y = ( uint32_t )( x ) & ~( mm_line - 1 ); y < ( ( uint32_t )( x ) + n ); y += mm_line ) {
+    mmu_clean_dcache( y );
+  }
+}
+
+uint32_t asid_generation = 1 << ASID_BITS;
+uint32_t asid_next       = 1;
+
+void mm_sync_mva( uint32_t x, uint32_t asid ) {
+  asm volatile( "dsb \n" ::: "memory" );
+  mmu_flush_mva( ( x & ~( PAGE_SIZE - 1 ) ) | ( asid & ( ( 1 << ASID_BITS ) - 1 ) ) );
+  asm volatile( "dsb \n"
+                "isb \n" ::: "memory" );
+}
+
+void mm_sync_asid( uint32_t asid ) {
+  asm volatile( "dsb \n" ::: "memory" );
+  mmu_flush_asid( asid & ( ( 1 << ASID_BITS ) - 1 ) );
+  asm volatile( "dsb \n"
+                "isb \n" ::: "memory" );
+}
+
+void mm_sync() {
+  asm volatile( "dsb \n" ::: "memory" );
+  mmu_flush();
+  asm volatile( "dsb \n"
+                "isb \n" ::: "memory" );
+}
+
+// true iff. s has an ASID valid in the current generation, so may have TLB entries
+bool space_live( mm_space_t* s ) {
+  return MM_ASID && ( ( s->asid & ~( ( 1 << ASID_BITS ) - 1 ) ) == asid_generation );
+}
+
+void mm_init() {
+  for( int i = 0; i < 4096; i++ ) {
+    bool ram = ( i >= 0x700 ) && ( i < 0x780 );
+
+    mm_l1[ i ] = ( i << 20 ) | ( ( i == 0 ) ? L1_SECTION_KERN : ram ? L1_SECTION_RAM : L1_SECTION_DEV );
+  }
+
+  memset( mm_l2,       0, sizeof( mm_l2       ) ); // every page starts off free, so unmapped
+  memset( mm_l1_idle,  0, sizeof( mm_l1_idle  ) );
+  memset( page_ref,    0, sizeof( page_ref    ) );
+  memset( page_order, -1, sizeof( page_order  ) );
+  memset( buddy_head, -1, sizeof( buddy_head  ) );
+
+  buddy_bitmap = 0;
+
+  for( int i = 0; i < POOL_PAGES; i += ( 1 << ( BUDDY_ORDERS - 1 ) ) ) {
+    buddy_push( i, BUDDY_ORDERS - 1 );
+  }
+  for( int i = 0; i < ( POOL_PAGES >> 8 ); i++ ) {
+    mm_l1[ ( ( uint32_t )( &pool_lo ) >> 20 ) + i ] = ( uint32_t )( &mm_l2[ i << 8 ] ) | L1_COARSE;
+  }
+  mm_l1_idle[ 0 ] = mm_l1[ 0 ]; // the vector table has to be mapped whatever TTBR0 points to
+
+  asm volatile( "mcr p15, 0, %0, c2, c0, 2 \n" // write TTBCR
+              :
+              : "r" (TTBCR_N) );
+
+  uint32_t ctr;
+
+  asm volatile( "mrc p15, 0, %0, c0, c0, 1 \n" // read CTR
+              : "=r" (ctr) );
+
+  mm_line = 4 << ( ( ctr >> 16 ) & 0xF );
+
+  mmu_set_ptr0( mm_l1_idle );
+  mmu_set_ptr1( mm_l1      );
+  mmu_set_dom( 0, 0x1 ); // client mode
+  mm_sync();
+
+  // the caches are in an unknown state out of reset, so invalidate them before enabling anything
+  mmu_inval_dcache();
+  mmu_flush_icache();
+
+  mmu_enable();
+  mmu_enable_caches();
+}
+
+uint32_t pages_alloc( int k ) {
+  page_allocs++;
+
+  if( k < 0 || k >= BUDDY_ORDERS || ( buddy_bitmap >> k ) == 0 ) {
+    page_fails++;
+    return 0;
+  }
+
+  int j = k + __builtin_ctz( buddy_bitmap >> k ), i = buddy_head[ j ];
+
+  buddy_unlink( i );
+
+  while( j > k ) { // keep the lower half, and free the upper one
+    j--; buddy_push( i + ( 1 << j ), j );
+  }
+
+  uint32_t x = ( uint32_t )( &pool_lo ) + ( i << PAGE_SHIFT );
+
+  for( int n = 0; n < ( 1 << k ); n++ ) {
+    page_ref[ i + n ] = 1;
+    mm_l2[ i + n ]    = ( x + ( n << PAGE_SHIFT ) ) | L2_SMALL_KERN;
+  }
+
+  mm_clean( &mm_l2[ i ], sizeof( uint32_t ) << k );
+
+  for( int n = 0; n < ( 1 << k ); n++ ) {
+    mm_sync_mva( x + ( n << PAGE_SHIFT ), 0 );
+  }
+
+  page_used += ( 1 << k );
+
+  return x;
+}
+
+void pages_free( uint32_t x, int k ) {
+  int i = page_index( x );
+
+  for( int n = 0; n < ( 1 << k ); n++ ) {
+    page_ref[ i + n ] = 0;
+    mm_l2[ i + n ]    = 0;
+  }
+
+  mm_clean( &mm_l2[ i ], sizeof( uint32_t ) << k );
+
+  for( int n = 0; n < ( 1 << k ); n++ ) {
+    mm_sync_mva( x + ( n << PAGE_SHIFT ), 0 );
+  }
+
+  page_used -= ( 1 << k );
+
+  while( k < ( BUDDY_ORDERS - 1 ) && page_order[ i ^ ( 1 << k ) ] == k ) {
+    buddy_unlink( i ^ ( 1 << k ) ); i &= ~( 1 << k ); k++; // merge with the (free) buddy
+  }
+
+  buddy_push( i, k );
+}
+
+uint32_t pages_largest() {
+  return ( buddy_bitmap == 0 ) ? 0 : ( 1 << ( 31 - __builtin_clz( buddy_bitmap ) ) );
+}
+
+uint32_t page_alloc() {
+  return pages_alloc( 0 );
+}
+
+void page_put( uint32_t x ) {
+  if( --page_ref[ page_index( x ) ] == 0 ) {
+    pages_free( x, 0 );
+  }
+}
+
+mm_space_t* space_alloc() {
+  mm_space_t* s = ( mm_space_t* )( page_alloc() );
+
+  if( s == NULL ) {
+    return NULL;
+  }
+
+  memset( s, 0, sizeof( mm_space_t ) );
+
+  s->users                    = 1;
+  s->l1[ 0                   ] = mm_l1[ 0 ];
+  s->l1[ STACK_WINDOW >> 20 ] = ( uint32_t )( s->l2 ) | L1_COARSE;
+  s->brk                      = HEAP_BASE;
+
+  mm_clean( s, sizeof( mm_space_t ) );
+
+  return s;
+}
+
+// allocate the second-level tables for the heap window of s, iff. they are not already; return false if impossible
+bool space_heap( mm_space_t* s ) {
+  if( s->heap != NULL ) {
+    return true;
+  }
+  if( ( s->heap = ( uint32_t* )( page_alloc() ) ) == NULL ) {
+    return false;
+  }
+
+  memset( s->heap, 0, PAGE_SIZE );
+  mm_clean( s->heap, PAGE_SIZE );
+
+  for( int i = 0; i < ( HEAP_PAGES >> 8 ); i++ ) {
+    s->l1[ ( HEAP_BASE >> 20 ) + i ] = ( uint32_t )( &s->heap[ i << 8 ] ) | L1_COARSE;
+  }
+
+  mm_clean( &s->l1[ HEAP_BASE >> 20 ], sizeof( uint32_t ) * ( HEAP_PAGES >> 8 ) );
+  asm volatile( "dsb \n" ::: "memory" ); // the entries were invalid, so cannot be in the TLB
+
+  return true;
+}
+
+mm_space_t* space_get( mm_space_t* s ) {
+  s->users++;
+
+  return s;
+}
+
+void space_free( mm_space_t* s ) {
+  if( --s->users != 0 ) {
+    return;
+  }
+
+  for( int i = 0; i < 256; i++ ) {
+    if( s->l2[ i ] != 0 ) {
+      page_put( s->l2[ i ] & ~( PAGE_SIZE - 1 ) );
+    }
+  }
+
+  if( s->heap != NULL ) {
+    for( int i = 0; i < HEAP_PAGES; i++ ) {
+      if( s->heap[ i ] != 0 ) {
+        page_put( s->heap[ i ] & ~( PAGE_SIZE - 1 ) );
+      }
+    }
+
+    page_put( ( uint32_t )( s->heap ) );
+  }
+
+  page_put( ( uint32_t )( s ) );
+}
+
+// the second-level table entry for address x in s, or NULL if x is in neither window (or the heap has no tables yet)
+uint32_t* space_entry( mm_space_t* s, uint32_t x ) {
+  if( ( x >> 20 ) == ( STACK_WINDOW >> 20 ) ) {
+    return &s->l2[ ( x >> PAGE_SHIFT ) & 0xFF ];
+  }
+  if( x >= HEAP_BASE && x < HEAP_TOP && s->heap != NULL ) {
+    return &s->heap[ ( x - HEAP_BASE ) >> PAGE_SHIFT ];
+  }
+
+  return NULL;
+}
+
+// discard any TLB entry for address x in s
+void space_sync( mm_space_t* s, uint32_t x ) {
+  if( space_live( s ) ) {
+    mm_sync_mva( x, s->asid );
+  }
+  else {
+    mm_sync();
+  }
+}
+
+// map a zeroed page at address x in s, which must have an entry; return false if impossible
+bool space_map( mm_space_t* s, uint32_t x ) {
+  uint32_t* e = space_entry( s, x );
+  uint32_t  y = page_alloc();
+
+  if( y == 0 ) {
+    return false;
+  }
+
+  memset( ( void* )( y ), 0, PAGE_SIZE );
+
+  *e = y | L2_SMALL_USER;
+  mm_clean( e, sizeof( uint32_t ) );
+  asm volatile( "dsb \n" ::: "memory" ); // the entry was invalid, so cannot be in the TLB
+
+  return true;
+}
+
+// unmap whatever page is at address x in s, if any
+void space_unmap( mm_space_t* s, uint32_t x ) {
+  uint32_t* e = space_entry( s, x );
+
+  if( e == NULL || *e == 0 ) {
+    return;
+  }
+
+  page_put( *e & ~( PAGE_SIZE - 1 ) );
+
+  *e = 0;
+  mm_clean( e, sizeof( uint32_t ) );
+  space_sync( s, x );
+}
+
+bool space_stack( mm_space_t* s, uint32_t n ) {
+  for( uint32_t x = STACK_TOP - n; x < STACK_TOP; x += PAGE_SIZE ) {
+    if( !space_map( s, x ) ) {
+      return false; // the caller frees s, and so whatever was mapped
+    }
+  }
+
+  s->stacks |= 1;
+
+  return true;
+}
+
+/* Each further stack goes in the highest free slot: slot i spans the
+ * STACK_SLOT bytes below STACK_TOP - ( i * STACK_SLOT ), of which at most
+ * all but the lowest page are mapped, so a stack that overflows faults
+ * rather than running into the next one down.
+ */
+
+uint32_t space_thread( mm_space_t* s, uint32_t n ) {
+  if( n == 0 || n > ( STACK_SLOT - PAGE_SIZE ) ) {
+    return 0;
+  }
+
+  for( int i = 1; i < STACK_SLOTS; i++ ) {
+    if( s->stacks & ( 1 << i ) ) {
+      continue;
+    }
+
+    uint32_t t = STACK_TOP - ( i * STACK_SLOT );
+
+    for( uint32_t x = t - n; x < t; x += PAGE_SIZE ) {
+      if( !space_map( s, x ) ) {
+        for( uint32_t y = t - n; y < x; y += PAGE_SIZE ) {
+          space_unmap( s, y );
+        }
+        return 0;
+      }
+    }
+
+    s->stacks |= ( 1 << i );
+
+    return t;
+  }
+
+  return 0;
+}
+
+void space_thread_free( mm_space_t* s, uint32_t t ) {
+  for( uint32_t x = t - ( STACK_SLOT - PAGE_SIZE ); x < t; x += PAGE_SIZE ) {
+    space_unmap( s, x );
+  }
+
+  s->stacks &= ~( 1 << ( ( STACK_TOP - t ) / STACK_SLOT ) );
+}
+
+/* Sharing the stack and heap is constant time, in the sense it depends
+ * only on the size of the windows, not on what is in them: each page is
+ * marked as read-only in both address spaces, and is only copied once
+ * either one writes to it (or, if the other has since dropped it, just
+ * made writable again).
+ */
+
+void space_share( uint32_t* s, uint32_t* t, int n ) {
+  for( int i = 0; i < n; i++ ) {
+    if( s[ i ] != 0 ) {
+      uint32_t x = s[ i ] & ~( PAGE_SIZE - 1 );
+
+      s[ i ] = t[ i ] = x | L2_SMALL_COW;
+      page_ref[ page_index( x ) ]++;
+    }
+  }
+
+  mm_clean( s, n * sizeof( uint32_t ) );
+  mm_clean( t, n * sizeof( uint32_t ) );
+}
+
+mm_space_t* space_fork( mm_space_t* s ) {
+  mm_space_t* t = space_alloc();
+
+  if( t == NULL ) {
+    return NULL;
+  }
+  if( s->heap != NULL && !space_heap( t ) ) {
+    space_free( t );
+    return NULL;
+  }
+
+  space_share( s->l2, t->l2, 256 );
+
+  if( s->heap != NULL ) {
+    space_share( s->heap, t->heap, HEAP_PAGES );
+  }
+
+  t->brk    = s->brk;
+  t->stacks = s->stacks;
+
+  if( space_live( s ) ) {
+    mm_sync_asid( s->asid );
+  }
+  else {
+    mm_sync();
+  }
+
+  return t;
+}
+
+bool space_copy( mm_space_t* s, uint32_t* e, uint32_t x ) {
+  uint32_t y = *e & ~( PAGE_SIZE - 1 );
+
+  if( page_ref[ page_index( y ) ] > 1 ) {
+    uint32_t z = page_alloc();
+
+    if( z == 0 ) {
+      return false;
+    }
+
+    memcpy( ( void* )( z ), ( void* )( y ), PAGE_SIZE );
+    page_put( y ); y = z;
+  }
+
+  *e = y | L2_SMALL_USER;
+  mm_clean( e, sizeof( uint32_t ) );
+  space_sync( s, x );
+
+  return true;
+}
+
+bool space_local( uint32_t x ) {
+  return x < ( 1 << ( 32 - TTBCR_N ) );
+}
+
+// true iff. the global mapping of x is a section USR mode can read and write, i.e., not the vector table, the pool or a hole
+bool space_global( uint32_t x ) {
+  return ( mm_l1[ x >> 20 ] & 0x00008C03 ) == 0x00000C02; // section, APX = 0, AP = 11
+}
+
+// check the n bytes from x are all mapped in s (or global, and accessible from USR mode), and, iff. w, make them writable
+bool space_access( mm_space_t* s, uint32_t x, uint32_t n, bool w ) {
+  if( ( x + n ) < x ) {
+    return false;
+  }
+  if( ( x < ( uint32_t )( &pool_hi ) ) && ( ( x + n ) > ( uint32_t )( &pool_lo ) ) ) {
+    return false; // the pool holds page tables and kernel objects, which a user pointer must never reach
+  }
+
+  uint32_t m = ( ( x & ( PAGE_SIZE - 1 ) ) + n + PAGE_SIZE - 1 ) >> PAGE_SHIFT;
+
+  for( uint32_t k = 0; k < m; k++ ) {
+    uint32_t y = ( x & ~( PAGE_SIZE - 1 ) ) + ( k << PAGE_SHIFT );
+    uint32_t* e = ( s != NULL ) ? space_entry( s, y ) : NULL;
+
+    if( e == NULL ) {
+      if( space_local( y ) || !space_global( y ) ) {
+        return false; // per-process, but outside either window, or global, but kernel-only
+      }
+      continue;
+    }
+
+    if( *e == 0 ) {
+      return false;
+    }
+    if( w && ( ( *e & 0xFFF ) == L2_SMALL_COW ) && !space_copy( s, e, y ) ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool space_read( mm_space_t* s, uint32_t x, uint32_t n ) {
+  return space_access( s, x, n, false );
+}
+
+bool space_write( mm_space_t* s, uint32_t x, uint32_t n ) {
+  return space_access( s, x, n, true  );
+}
+
+bool space_fault( mm_space_t* s, uint32_t x ) {
+  uint32_t* e = ( s != NULL ) ? space_entry( s, x ) : NULL;
+
+  if( e == NULL || ( *e & 0xFFF ) != L2_SMALL_COW ) {
+    return false;
+  }
+
+  return space_copy( s, e, x & ~( PAGE_SIZE - 1 ) );
+}
+
+uint32_t space_sbrk( mm_space_t* s, int32_t n ) {
+  uint32_t b = s->brk, e = b + n;
+
+  if( ( n > 0 && e < b ) || ( n < 0 && e > b ) || e < HEAP_BASE || e > HEAP_TOP || !space_heap( s ) ) {
+    return 0;
+  }
+
+  for( uint32_t x = PAGE_ROUND( b ); x < PAGE_ROUND( e ); x += PAGE_SIZE ) {
+    if( *space_entry( s, x ) != 0 || !space_map( s, x ) ) { // collides with a region, or out of memory
+      for( uint32_t y = PAGE_ROUND( b ); y < x; y += PAGE_SIZE ) {
+        space_unmap( s, y );
+      }
+      return 0;
+    }
+  }
+  for( uint32_t x = PAGE_ROUND( e ); x < PAGE_ROUND( b ); x += PAGE_SIZE ) {
+    space_unmap( s, x );
+  }
+
+  s->brk = e;
+
+  return b;
+}
+
+uint32_t space_mmap( mm_space_t* s, uint32_t n ) {
+  n = PAGE_ROUND( n );
+
+  if( n == 0 || n > ( HEAP_TOP - HEAP_BASE ) || !space_heap( s ) ) {
+    return 0;
+  }
+
+  uint32_t m = 0; // size of the run of unmapped pages from x upwards
+
+  for( uint32_t x = HEAP_TOP - PAGE_SIZE; x >= PAGE_ROUND( s->brk ) && x >= HEAP_BASE; x -= PAGE_SIZE ) {
+    m = ( *space_entry( s, x ) == 0 ) ? ( m + PAGE_SIZE ) : 0;
+
+    if( m < n ) {
+      continue;
+    }
+
+    for( uint32_t y = x; y < ( x + n ); y += PAGE_SIZE ) {
+      if( !space_map( s, y ) ) {
+        space_munmap( s, x, y - x );
+        return 0;
+      }
+    }
+
+    return x;
+  }
+
+  return 0;
+}
+
+bool space_munmap( mm_space_t* s, uint32_t x, uint32_t n ) {
+  n = PAGE_ROUND( n );
+
+  if( ( x & ( PAGE_SIZE - 1 ) ) != 0 || x < PAGE_ROUND( s->brk ) || x > HEAP_TOP || n > ( HEAP_TOP - x ) ) {
+    return false;
+  }
+
+  for( uint32_t y = x; y < ( x + n ); y += PAGE_SIZE ) {
+    space_unmap( s, y );
+  }
+
+  return true;
+}
+
+/* Switching TTBR0 and the ASID cannot be done atomically, so, per Section
+ * B3.10.4 of the ARM ARM, the reserved ASID 0 is used in between: nothing
+ * with that ASID is ever mapped non-global, so no TLB entry can be created
+ * for the wrong combination.
+ */
+
+uint32_t space_asid( mm_space_t* s ) {
+  if( !space_live( s ) ) {
+    if( asid_next == ( 1 << ASID_BITS ) ) {
+      asid_generation += 1 << ASID_BITS; // out of ASIDs, so start a new generation
+      asid_next        = 1;
+
+      if( asid_generation == 0 ) {
+        asid_generation = 1 << ASID_BITS; // so a new, zeroed address space is never valid
+      }
+
+      mm_sync();
+    }
+
+    s->asid = asid_generation | asid_next++;
+  }
+
+  return s->asid & ( ( 1 << ASID_BITS ) - 1 );
+}
+
+void space_switch( mm_space_t* s ) {
+  if( !MM_ASID ) {
+    mmu_set_ptr0( ( s != NULL ) ? s->l1 : mm_l1_idle );
+    mm_sync();
+
+    return;
+  }
+
+  uint32_t asid = ( s != NULL ) ? space_asid( s ) : 0;
+
+  mmu_set_asid( 0 );
+  asm volatile( "isb \n" ::: "memory" );
+  mmu_set_ptr0( ( s != NULL ) ? s->l1 : mm_l1_idle );
+  asm volatile( "isb \n" ::: "memory" );
+  mmu_set_asid( asid );
+  asm volatile( "isb \n" ::: "memory" );
+}
+
+void mm_fault( bool d, uint32_t* addr, uint32_t* status ) {
+  if( d ) {
+    asm volatile( "mrc p15, 0, %0, c6, c0, 0 \n" // read DFAR
+                  "mrc p15, 0, %1, c5, c0, 0 \n" // read DFSR
+                : "=r" (*addr), "=r" (*status) );
+  }
+  else {
+    asm volatile( "mrc p15, 0, %0, c6, c0, 2 \n" // read IFAR
+                  "mrc p15, 0, %1, c5, c0, 1 \n" // read IFSR
+                : "=r" (*addr), "=r" (*status) );
+  }
+}
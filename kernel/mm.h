@@ -0,0 +1,155 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __MM_H
+#define __MM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "MMU.h"
+
+/* Translation is split between two page tables (via TTBCR.N = 7):
+ *
+ * - addresses at or above 32MiB use a global table, pointed to by TTBR1,
+ *   which identity-maps (i.e., translates each virtual address to the
+ *   same physical address) the kernel image, devices and so on, and
+ * - addresses below 32MiB use a per-process table, pointed to by TTBR0,
+ *   which is switched along with the executing process.
+ *
+ * The kernel image includes the user programs, so everything they share
+ * (text, data and bss) is global.  A process' address space is therefore
+ * just
+ *
+ * - its stacks, each of which includes the thread-local area libc keeps
+ *   per-thread state in: every process sees its own (first) stack at the
+ *   same address, just below STACK_TOP, and any further ones for threads
+ *   (which share the address space) in slots below that, and
+ * - its heap window, from HEAP_BASE to HEAP_TOP, in which pages are mapped
+ *   on request: upwards from HEAP_BASE to the break (via sbrk), and as
+ *   separate regions anywhere above it (via mmap), which are found by
+ *   searching downwards from HEAP_TOP,
+ *
+ * both of which a fork shares copy-on-write.
+ *
+ * Physical memory for stacks, for the per-process page tables and for any
+ * other kernel object (via the slab caches in kmem.h) comes from a pool of
+ * 4KiB pages, which is identity-mapped in the global table but, for pages
+ * that are allocated, only accessible to the kernel, and for those that
+ * are free, not at all.  Pages are allocated in blocks of 2^k for k below
+ * BUDDY_ORDERS, i.e., of up to 1MiB, which is the alignment of the pool.
+ */
+
+#define PAGE_SHIFT   ( 12 )
+#define PAGE_SIZE    ( 1 << PAGE_SHIFT )
+#define POOL_BITS    ( 10 )
+#define POOL_PAGES   ( 1 << POOL_BITS ) // i.e., 4MiB, which image.ld reserves
+#define BUDDY_ORDERS (  9 )
+
+// round x up to a whole number of pages
+#define PAGE_ROUND( x ) ( ( ( x ) + PAGE_SIZE - 1 ) & ~( PAGE_SIZE - 1 ) )
+
+#define STACK_WINDOW ( 0x01F00000 ) // the 1MiB section in which stacks are mapped, below 32MiB
+#define STACK_TOP    ( 0x02000000 )
+#define STACK_SLOT   ( 0x00011000 ) // the part of the window each stack may use, including a guard page
+#define STACK_SLOTS  ( ( STACK_TOP - STACK_WINDOW ) / STACK_SLOT )
+
+#define HEAP_BASE    ( 0x01000000 ) // the 4MiB window in which a heap is mapped, below STACK_WINDOW
+#define HEAP_TOP     ( 0x01400000 )
+#define HEAP_PAGES   ( ( HEAP_TOP - HEAP_BASE ) >> PAGE_SHIFT )
+
+/* An address space is a first-level table (of which only the 32 entries
+ * for the first 32MiB are used), plus a second-level table for the stack
+ * window: both fit in (and are suitably aligned within) one page.  The
+ * second-level tables for the heap window, i.e., one per 1MiB section,
+ * fill another page, which is only allocated once the heap is first used.
+ * Threads share one address space, so it counts its users, and is only
+ * freed once the last one is done with it.
+ *
+ * Each address space is also tagged with an Address Space IDentifier
+ * (ASID), and its mappings are marked non-global, so TLB entries for it
+ * survive a switch to some other address space and back.  There are only
+ * 255 ASIDs (ASID 0 is reserved, for the idle task), so these are handed
+ * out lazily, i.e., when an address space is switched to, as per Linux: an
+ * ASID is valid only if it was allocated in the current generation, and
+ * once they run out, the generation is advanced and the whole TLB flushed.
+ * Unless MM_ASID is set (to 1, which is the default), the TLB is flushed
+ * on every switch instead.
+ */
+
+#ifndef MM_ASID
+#define MM_ASID      ( 1 )
+#endif
+
+#define ASID_BITS    ( 8 )
+
+typedef struct {
+  uint32_t  l2[ 256 ];
+  uint32_t  l1[  32 ];
+  uint32_t  asid;     // generation in bits 31 ... ASID_BITS, ASID in the rest
+  uint32_t* heap;     // second-level tables for the heap window, or NULL if not yet allocated
+  uint32_t  brk;      // the break, i.e., the end of the heap
+  uint32_t  stacks;   // bitmap of stack slots in use
+  uint32_t  users;    // number of references, i.e., threads using it
+} mm_space_t;
+
+// initialise the page tables, then enable the MMU
+extern void        mm_init();
+
+// allocate a block of 2^k pages, returning its (physical) address, or 0 if impossible
+extern uint32_t    pages_alloc( int k );
+// free the block of 2^k pages at x, as allocated by pages_alloc
+extern void        pages_free( uint32_t x, int k );
+// return the number of pages in the largest free block, or 0 if there are none
+extern uint32_t    pages_largest();
+
+extern uint32_t    page_used;   // pages currently allocated
+extern uint32_t    page_allocs; // calls to pages_alloc
+extern uint32_t    page_fails;  // calls to pages_alloc that failed
+
+// allocate a page, returning its (physical) address, or 0 if impossible
+extern uint32_t    page_alloc();
+// drop a reference to page x, which is freed once there are none left
+extern void        page_put( uint32_t x );
+
+// allocate an empty address space, or return NULL if impossible
+extern mm_space_t* space_alloc();
+// add a reference to address space s, returning s
+extern mm_space_t* space_get( mm_space_t* s );
+// drop a reference to address space s, which, once there are none left, is freed along with a reference to every page mapped in it
+extern void        space_free( mm_space_t* s );
+// map n bytes (a multiple of PAGE_SIZE) of zeroed stack below STACK_TOP in s; return false if impossible
+extern bool        space_stack( mm_space_t* s, uint32_t n );
+// map n bytes (a multiple of PAGE_SIZE) of zeroed stack in a free slot in s; return its top, or 0 if impossible
+extern uint32_t    space_thread( mm_space_t* s, uint32_t n );
+// unmap the stack whose top is t, as mapped by space_thread, freeing its slot
+extern void        space_thread_free( mm_space_t* s, uint32_t t );
+// return a copy-on-write copy of address space s, or NULL if impossible
+extern mm_space_t* space_fork( mm_space_t* s );
+// return true iff. address x is per-process, i.e., translated via the table of whichever address space is current
+extern bool        space_local( uint32_t x );
+// check n bytes from x are readable in s; return false if any are not mapped, or are kernel-only (e.g., in the pool)
+extern bool        space_read( mm_space_t* s, uint32_t x, uint32_t n );
+// make n bytes from x writable in s (copying pages as needed); return false if any are not mapped, or are kernel-only
+extern bool        space_write( mm_space_t* s, uint32_t x, uint32_t n );
+// handle a write fault at x in s, returning true iff. it was resolved (i.e., was copy-on-write)
+extern bool        space_fault( mm_space_t* s, uint32_t x );
+// move the break of s by n bytes, mapping or unmapping zeroed pages; return the old break, or 0 if impossible
+extern uint32_t    space_sbrk( mm_space_t* s, int32_t n );
+// map n bytes (rounded up to a multiple of PAGE_SIZE) of zeroed pages above the break in s; return the address, or 0 if impossible
+extern uint32_t    space_mmap( mm_space_t* s, uint32_t n );
+// unmap n bytes (rounded up to a multiple of PAGE_SIZE) from x, which must be above the break in s; return false if impossible
+extern bool        space_munmap( mm_space_t* s, uint32_t x, uint32_t n );
+// switch to address space s, or, if s = NULL, to one with no stack window
+extern void        space_switch( mm_space_t* s );
+
+// read the address and status of the last data (d = true) or prefetch (d = false) abort
+extern void        mm_fault( bool d, uint32_t* addr, uint32_t* status );
+
+#endif
@@ -0,0 +1,245 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "timer.h"
+#include "hilevel.h"
+
+/* Each level of the wheel is an array of slots plus a bitmap in which bit
+ * s is set iff. slot s is non-empty.  The wheel keeps track of
+ *
+ * - wheel_now,   the time (in wheel ticks) up to and including which every
+ *   timer has been expired, and
+ * - wheel_clock, the clock time (in clock ticks) at which wheel_now began,
+ *
+ * so it can be brought up to date, by however many wheel ticks have gone
+ * by, whenever it is used.
+ */
+
+typedef struct {
+  ktimer_t* slot[ WHEEL_SLOTS ];
+  uint64_t  bitmap;
+} wheel_level_t;
+
+wheel_level_t wheel[ WHEEL_LEVELS ];
+uint32_t      wheel_now;
+uint32_t      wheel_clock;
+
+/* Find the distance from slot s to the first non-empty slot at or after
+ * it (wrapping round), or -1 if every slot is empty.
+ */
+
+int wheel_scan( uint64_t b, int s ) {
+  if( b == 0 ) {
+    return -1;
+  }
+  if( s != 0 ) {
+    b = ( b >> s ) | ( b << ( WHEEL_SLOTS - s ) );
+  }
+
+  return __builtin_ctzll( b );
+}
+
+void wheel_insert( ktimer_t* t ) {
+  uint32_t d = t->expiry - wheel_now; int l = 0;
+
+  while( ( l < ( WHEEL_LEVELS - 1 ) ) && ( d >= ( 1 << ( WHEEL_BITS * ( l + 1 ) ) ) ) ) {
+    l++;
+  }
+
+  int s = ( t->expiry >> ( WHEEL_BITS * l ) ) & ( WHEEL_SLOTS - 1 );
+
+  t->level = l;
+  t->slot  = s;
+  t->prev  = NULL;
+  t->next  = wheel[ l ].slot[ s ];
+
+  if( t->next != NULL ) {
+    t->next->prev = t;
+  }
+
+  wheel[ l ].slot[ s ] = t;
+  wheel[ l ].bitmap   |= ( ( uint64_t )( 1 ) << s );
+}
+
+void wheel_remove( ktimer_t* t ) {
+  int l = t->level, s = t->slot;
+
+  if( t->prev != NULL ) {
+    t->prev->next = t->next;
+  }
+  else {
+    wheel[ l ].slot[ s ] = t->next;
+  }
+  if( t->next != NULL ) {
+    t->next->prev = t->prev;
+  }
+
+  if( wheel[ l ].slot[ s ] == NULL ) {
+    wheel[ l ].bitmap &= ~( ( uint64_t )( 1 ) << s );
+  }
+}
+
+/* Detach and return the whole list of timers in slot s of level l.
+ */
+
+ktimer_t* wheel_take( int l, int s ) {
+  ktimer_t* t = wheel[ l ].slot[ s ];
+
+  wheel[ l ].slot[ s ] = NULL;
+  wheel[ l ].bitmap   &= ~( ( uint64_t )( 1 ) << s );
+
+  return t;
+}
+
+/* Find the next time, after wheel_now, at which something happens: either
+ * a timer in level 0 expires, or a slot in some higher level is reached
+ * and so has to cascade.  Return false iff. the wheel is empty.
+ */
+
+bool wheel_next( uint32_t* r ) {
+  bool f = false;
+
+  for( int l = 0; l < WHEEL_LEVELS; l++ ) {
+    uint32_t b = ( wheel_now >> ( WHEEL_BITS * l ) ) + 1;
+    int      k = wheel_scan( wheel[ l ].bitmap, b & ( WHEEL_SLOTS - 1 ) );
+
+    if( k < 0 ) {
+      continue;
+    }
+
+    uint32_t t = ( b + k ) << ( WHEEL_BITS * l );
+
+    if( !f || ( ( int32_t )( t - *r ) < 0 ) ) {
+      *r = t; f = true;
+    }
+  }
+
+  return f;
+}
+
+/* Move the wheel on to time t, which must be the next time something
+ * happens: first cascade any higher level slot that starts at t (highest
+ * level first, so timers can cascade more than one level at once), then
+ * expire everything in the level 0 slot for t.
+ */
+
+void wheel_step( uint32_t t ) {
+  wheel_now = t;
+
+  for( int l = WHEEL_LEVELS - 1; l > 0; l-- ) {
+    if( ( t & ( ( 1 << ( WHEEL_BITS * l ) ) - 1 ) ) == 0 ) {
+      ktimer_t* x = wheel_take( l, ( t >> ( WHEEL_BITS * l ) ) & ( WHEEL_SLOTS - 1 ) );
+
+      while( x != NULL ) {
+        ktimer_t* y = x->next; wheel_insert( x ); x = y;
+      }
+    }
+  }
+
+  ktimer_t* x = wheel_take( 0, t & ( WHEEL_SLOTS - 1 ) );
+
+  while( x != NULL ) {
+    ktimer_t* y = x->next; x->pending = false; x->fn( x ); x = y;
+  }
+}
+
+/* Bring the wheel up to date wrt. the clock.  Note that if the wheel is
+ * empty for long enough that the clock wraps round, the wheel time will
+ * be wrong by a multiple of that period; this does not matter, since the
+ * wheel time of any timer added afterwards is relative to it.
+ */
+
+void wheel_sync() {
+  uint32_t n = ( clock_now() - wheel_clock ) >> WHEEL_TICK_SHIFT;
+  uint32_t t = wheel_now + n, e;
+
+  wheel_clock += n << WHEEL_TICK_SHIFT;
+
+  while( wheel_next( &e ) && ( ( int32_t )( e - t ) <= 0 ) ) {
+    wheel_step( e );
+  }
+
+  wheel_now = t;
+}
+
+/* Program the second channel of TIMER1 to interrupt at the next time
+ * something happens, if anything does; the period is capped, and if it
+ * expires early the wheel is simply brought up to date and reprogrammed.
+ */
+
+#define WHEEL_DELAY_MIN ( 0x00000010 )
+#define WHEEL_DELAY_MAX ( 0x40000000 )
+
+void wheel_reprogram() {
+  TIMER1->Timer2Ctrl  = 0x00000000; // disable          timer
+
+  uint32_t t;
+
+  if( !wheel_next( &t ) ) {
+    return;
+  }
+
+  uint32_t n = t - wheel_now;
+
+  if( n > ( WHEEL_DELAY_MAX >> WHEEL_TICK_SHIFT ) ) {
+    n = ( WHEEL_DELAY_MAX >> WHEEL_TICK_SHIFT );
+  }
+
+  int32_t d = ( int32_t )( wheel_clock + ( n << WHEEL_TICK_SHIFT ) - clock_now() );
+
+  TIMER1->Timer2Load  = ( d < WHEEL_DELAY_MIN ) ? WHEEL_DELAY_MIN : d;
+  TIMER1->Timer2Ctrl  = 0x00000002; // select 32-bit    timer
+  TIMER1->Timer2Ctrl |= 0x00000001; // select one-shot  timer
+  TIMER1->Timer2Ctrl |= 0x00000020; // enable           timer interrupt
+  TIMER1->Timer2Ctrl |= 0x00000080; // enable           timer
+}
+
+void timer_init() {
+  memset( wheel, 0, sizeof( wheel ) );
+
+  wheel_now   = 0;
+  wheel_clock = clock_now();
+
+  TIMER1->Timer2Ctrl  = 0x00000000; // disable          timer
+}
+
+void timer_add( ktimer_t* t, uint32_t n ) {
+  if( t->pending ) {
+    wheel_remove( t );
+  }
+
+  wheel_sync();
+
+  // round up, counting the part of the current wheel tick already gone
+  uint64_t d = ( ( uint64_t )( n ) + ( clock_now() - wheel_clock ) + WHEEL_TICK - 1 ) >> WHEEL_TICK_SHIFT;
+
+  d = ( d < 1 ) ? 1 : ( d > WHEEL_MAX ) ? WHEEL_MAX : d;
+
+  t->expiry  = wheel_now + ( uint32_t )( d );
+  t->pending = true;
+
+  wheel_insert( t );
+  wheel_reprogram();
+}
+
+void timer_cancel( ktimer_t* t ) {
+  if( !t->pending ) {
+    return;
+  }
+
+  t->pending = false;
+
+  wheel_remove( t );
+  wheel_reprogram();
+}
+
+void timer_irq() {
+  TIMER1->Timer2IntClr = 0x01;
+
+  wheel_sync();
+  wheel_reprogram();
+}
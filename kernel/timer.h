@@ -0,0 +1,60 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __TIMER_H
+#define __TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel timers are kept in a hierarchical timing wheel, per
+ *
+ * G. Varghese and T. Lauck. Hashed and Hierarchical Timing Wheels: Data
+ * Structures for the Efficient Implementation of a Timer Facility. In
+ * Symposium on Operating Systems Principles (SOSP), 25--38, 1987.
+ *
+ * Time is measured in wheel ticks of WHEEL_TICK clock ticks (i.e., about
+ * 1ms).  There are WHEEL_LEVELS levels of WHEEL_SLOTS slots each: a timer
+ * due within WHEEL_SLOTS^( l + 1 ) ticks is placed in level l, in a slot
+ * that covers WHEEL_SLOTS^l ticks, and is cascaded down to level l - 1
+ * once the wheel reaches the start of that slot.  Each slot is a doubly-
+ * linked list, and each level has a bitmap of non-empty slots, so adding,
+ * cancelling and expiring a timer are all constant time, and the next
+ * time anything happens can be found without scanning the slots.
+ *
+ * The wheel does not tick: the second channel of TIMER1 is programmed as
+ * a one-shot timer for the next time a timer expires or has to cascade,
+ * and is stopped altogether when there are no timers.
+ */
+
+#define WHEEL_TICK_SHIFT ( 10 )
+#define WHEEL_TICK       ( 1 << WHEEL_TICK_SHIFT )
+#define WHEEL_BITS       (  6 )
+#define WHEEL_SLOTS      ( 1 << WHEEL_BITS )
+#define WHEEL_LEVELS     (  4 )
+#define WHEEL_MAX        ( ( 1 << ( WHEEL_BITS * WHEEL_LEVELS ) ) - 1 )
+
+typedef struct ktimer_s {
+  struct ktimer_s* prev;
+  struct ktimer_s* next;
+  uint32_t expiry;                     // absolute, in wheel ticks
+      bool pending;                    // true iff. currently in the wheel
+   uint8_t level, slot;                // position in the wheel, iff. pending
+      void (*fn)( struct ktimer_s* t ); // invoked on expiry
+} ktimer_t;
+
+// initialise the wheel (and the timer channel that drives it)
+extern void timer_init();
+// add t st. t->fn is invoked in n clock ticks (rounded up to wheel ticks)
+extern void timer_add( ktimer_t* t, uint32_t n );
+// cancel t, iff. it is pending
+extern void timer_cancel( ktimer_t* t );
+// handle an interrupt from the timer channel, expiring whatever is due
+extern void timer_irq();
+
+#endif
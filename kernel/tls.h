@@ -0,0 +1,20 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __TLS_H
+#define __TLS_H
+
+/* The top TLS_SIZE bytes of each process' stack are reserved as a thread-
+ * local area, whose address the process can read from TPIDRURO: this is
+ * where libc keeps per-process state (e.g., stdio buffers), since every
+ * process otherwise shares the same global variables.  Both the kernel and
+ * libc (see tls_t in user/libc.h) include this, so they agree on the size.
+ */
+
+#define TLS_SIZE ( 0x00000200 )
+
+#endif
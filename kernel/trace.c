@@ -0,0 +1,74 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "trace.h"
+
+/* The ring is drained a byte at a time, so the indices count bytes rather
+ * than records; as for a tty, they are free-running.
+ */
+
+trace_t  trace_ring[ TRACE_SIZE ];
+uint32_t trace_head;                // next byte written by trace
+uint32_t trace_tail;                // next byte sent    to UART3
+uint32_t trace_lost;                // records dropped since the last TRACE_LOST
+
+void trace_put( trace_type_t x, pid_t pid, uint32_t y ) {
+  trace_t* r = &trace_ring[ ( trace_head / sizeof( trace_t ) ) & ( TRACE_SIZE - 1 ) ];
+
+  r->time    = clock_now();
+  r->type    = x;
+  r->pid     = pid;
+  r->arg     = y;
+
+  trace_head += sizeof( trace_t );
+}
+
+void trace( trace_type_t x, pid_t pid, uint32_t y ) {
+  // keep one record spare, so there is always space to report a loss
+  if( ( trace_head - trace_tail ) > ( ( TRACE_SIZE - 2 ) * sizeof( trace_t ) ) ) {
+    trace_lost++; return;
+  }
+
+  if( trace_lost != 0 ) {
+    trace_put( TRACE_LOST, 0, trace_lost ); trace_lost = 0;
+  }
+
+  trace_put( x, pid, y );
+}
+
+void trace_drain() {
+  uint8_t* r = ( uint8_t* )( trace_ring );
+
+  while( trace_tail != trace_head && PL011_can_putc( UART3 ) ) {
+    PL011_putc( UART3, r[ trace_tail++ & ( sizeof( trace_ring ) - 1 ) ], false );
+  }
+
+  if( trace_tail != trace_head ) {
+    UART3->IMSC |=  0x00000020;       // enable  transmit interrupt
+  }
+  else {
+    UART3->IMSC &= ~0x00000020;       // disable transmit interrupt
+  }
+}
+
+void trace_init() {
+  trace_head = 0;
+  trace_tail = 0;
+  trace_lost = 0;
+
+  UART3->LCR  |= 0x00000010;          // enable FIFOs
+  UART3->IFLS  = 0x00000001;          // select transmit level 1/4
+  UART3->ICR   = 0x000007FF;          // clear  any pending interrupts
+
+  trace_put( TRACE_START, 0, TRACE_VERSION );
+}
+
+void trace_irq() {
+  UART3->ICR = 0x00000020;            // clear  transmit    interrupt
+
+  trace_drain();
+}
@@ -0,0 +1,93 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hilevel.h"
+
+/* The kernel records what it does as a stream of fixed-size, binary trace
+ * records in a ring buffer, which is drained (via the transmit interrupt,
+ * much like a tty) over UART3; QEMU can capture this to a file, which the
+ * host-side script kernel/trace.py then converts into Chrome trace JSON
+ * (viewable via chrome://tracing or Perfetto).
+ *
+ * Each record is a 32-bit timestamp (in clock ticks, from the free-running
+ * TIMER1) plus the record type, a PID and a type-specific argument, each
+ * of the latter 32 bits (since PIDs come from a counter, so soon outgrow
+ * anything smaller), which makes a record 16 bytes:
+ *
+ * type              pid               arg
+ * ----------------  ----------------  ----------------------------
+ * TRACE_START       0                 TRACE_VERSION
+ * TRACE_LOST        0                 number of records dropped
+ * TRACE_SWITCH      next process      previous process
+ * TRACE_WAKE        woken process     0
+ * TRACE_SVC_ENTER   caller            system call identifier
+ * TRACE_SVC_EXIT    caller            system call identifier
+ * TRACE_IRQ_ENTER   current process   interrupt identifier
+ * TRACE_IRQ_EXIT    current process   interrupt identifier
+ * TRACE_FORK        parent            child
+ * TRACE_EXEC        caller            0
+ * TRACE_EXIT        caller            exit status
+ * TRACE_KILL        caller            target
+ * TRACE_PIPE        caller            file descriptor
+ * TRACE_OPEN        caller            file descriptor
+ * TRACE_FAULT       faulting process  faulting address / 4KiB
+ * TRACE_SPAWN       caller            new process
+ * TRACE_THREAD      caller            new thread
+ *
+ * Recording just fills in the next record, so costs a handful of cycles;
+ * if the ring is full (i.e., UART3 cannot keep up), records are dropped
+ * and a TRACE_LOST record says how many once there is space again.
+ */
+
+#define TRACE_VERSION ( 2 )
+#define TRACE_SIZE    ( 1024 ) // number of records, a power of 2
+
+typedef enum {
+  TRACE_START,
+  TRACE_LOST,
+  TRACE_SWITCH,
+  TRACE_WAKE,
+  TRACE_SVC_ENTER,
+  TRACE_SVC_EXIT,
+  TRACE_IRQ_ENTER,
+  TRACE_IRQ_EXIT,
+  TRACE_FORK,
+  TRACE_EXEC,
+  TRACE_EXIT,
+  TRACE_KILL,
+  TRACE_PIPE,
+  TRACE_OPEN,
+  TRACE_FAULT,
+  TRACE_SPAWN,
+  TRACE_THREAD
+} trace_type_t;
+
+typedef struct {
+  uint32_t time;
+  uint8_t  type;
+  uint8_t  pad[ 3 ];
+  uint32_t pid;
+  uint32_t arg;
+} trace_t;
+
+// initialise the trace ring (and UART3, which drains it)
+extern void trace_init();
+// record an event of type x, for process pid, with argument y
+extern void trace( trace_type_t x, pid_t pid, uint32_t y );
+// send as much of the trace ring as possible via UART3
+extern void trace_drain();
+// handle an interrupt from UART3
+extern void trace_irq();
+
+#endif
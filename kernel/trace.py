@@ -0,0 +1,113 @@
+# Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+#
+# Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+# which can be found via http://creativecommons.org (and should be included as
+# LICENSE.txt within the associated archive or repository).
+
+import argparse, json, struct, sys
+
+# The record layout and types must match kernel/trace.h.
+
+RECORD = struct.Struct( '<IB3xII' )
+
+TRACE_VERSION = 2
+
+TYPES = [ 'start', 'lost', 'switch', 'wake', 'svc-enter', 'svc-exit', 'irq-enter', 'irq-exit', 'fork', 'exec', 'exit', 'kill', 'pipe', 'open', 'fault', 'spawn', 'thread' ]
+
+SVC   = { 0x00 : 'yield', 0x01 : 'write', 0x02 : 'read', 0x03 : 'fork', 0x04 : 'exit', 0x05 : 'exec', 0x06 : 'kill', 0x07 : 'nice', 0x08 : 'pipe', 0x09 : 'open', 0x0A : 'sched_rt', 0x0B : 'sched_rt_misses', 0x0C : 'sleep', 0x0D : 'ps', 0x0E : 'getpid', 0x0F : 'irq_latency', 0x10 : 'klog_level', 0x11 : 'kmem', 0x12 : 'sbrk', 0x13 : 'mmap', 0x14 : 'munmap', 0x15 : 'spawn', 0x16 : 'thread', 0x17 : 'thread_exit', 0x18 : 'thread_join', 0x19 : 'futex_wait', 0x1A : 'futex_wake', 0x1B : 'waitpid', 0x1C : 'close' }
+IRQ   = { 36 : 'TIMER0', 37 : 'TIMER1', 44 : 'UART0', 45 : 'UART1', 47 : 'UART3' }
+
+# Interrupts are shown on a track of their own, rather than against the
+# process they happened to interrupt, which no PID can clash with.
+
+TID_IRQ = -1
+
+# Read the raw records, skipping anything before the first TRACE_START (in
+# case the capture was not started at reset), and unwrap the 32-bit clock
+# into a 64-bit one.
+
+def records( data ) :
+  r = [] ; base = 0 ; last = None ; started = False
+
+  for i in range( 0, len( data ) - RECORD.size + 1, RECORD.size ) :
+    ( time, type, pid, arg ) = RECORD.unpack_from( data, i )
+
+    if( type >= len( TYPES ) ) :
+      sys.stderr.write( 'invalid record at offset %d\n' % ( i ) ) ; break
+
+    if( not started ) :
+      if( TYPES[ type ] != 'start' ) :
+        continue
+      if( arg != TRACE_VERSION ) :
+        sys.stderr.write( 'unsupported trace version %d\n' % ( arg ) ) ; break
+
+      started = True
+
+    if( last != None and time < last ) :
+      base += 1 << 32
+
+    last = time ; r.append( ( base + time, TYPES[ type ], pid, arg ) )
+
+  return r
+
+def name( pid ) :
+  return 'idle' if pid == 0 else ( 'pid %d' % ( pid ) )
+
+# Convert the records into Chrome trace events, i.e., per process
+#
+# - a complete ('X') event for each period it was executing,
+# - a begin/end ('B'/'E') pair for each system call, and
+# - an instant ('i') event for anything else,
+#
+# plus a begin/end pair on the interrupt track for each interrupt.
+
+def chrome( r ) :
+  events = [] ; tids = set( [ 0 ] ) ; running = None
+
+  for ( time, type, pid, arg ) in r :
+    if  ( type == 'switch'    ) :
+      if( running != None ) :
+        events.append( { 'name' : 'executing', 'ph' : 'X', 'ts' : running[ 1 ], 'dur' : time - running[ 1 ], 'pid' : 0, 'tid' : running[ 0 ] } )
+
+      running = ( pid, time )
+    elif( type == 'svc-enter' ) :
+      events.append( { 'name' : SVC.get( arg, 'svc 0x%02X' % ( arg ) ), 'ph' : 'B', 'ts' : time, 'pid' : 0, 'tid' : pid } )
+    elif( type == 'svc-exit'  ) :
+      events.append( { 'name' : SVC.get( arg, 'svc 0x%02X' % ( arg ) ), 'ph' : 'E', 'ts' : time, 'pid' : 0, 'tid' : pid } )
+    elif( type == 'irq-enter' ) :
+      events.append( { 'name' : IRQ.get( arg, 'irq %d'     % ( arg ) ), 'ph' : 'B', 'ts' : time, 'pid' : 0, 'tid' : TID_IRQ, 'args' : { 'interrupted' : pid } } )
+    elif( type == 'irq-exit'  ) :
+      events.append( { 'name' : IRQ.get( arg, 'irq %d'     % ( arg ) ), 'ph' : 'E', 'ts' : time, 'pid' : 0, 'tid' : TID_IRQ } )
+    else :
+      events.append( { 'name' : type, 'ph' : 'i', 's' : 't', 'ts' : time, 'pid' : 0, 'tid' : pid, 'args' : { 'arg' : arg } } )
+
+    if( type != 'irq-enter' and type != 'irq-exit' ) :
+      tids.add( pid )
+
+  if( running != None and len( r ) > 0 ) :
+    events.append( { 'name' : 'executing', 'ph' : 'X', 'ts' : running[ 1 ], 'dur' : r[ -1 ][ 0 ] - running[ 1 ], 'pid' : 0, 'tid' : running[ 0 ] } )
+
+  for tid in tids :
+    events.append( { 'name' : 'thread_name', 'ph' : 'M', 'pid' : 0, 'tid' : tid,     'args' : { 'name' : name( tid ) } } )
+
+  events.append(   { 'name' : 'thread_name', 'ph' : 'M', 'pid' : 0, 'tid' : TID_IRQ, 'args' : { 'name' : 'interrupts' } } )
+  events.append(   { 'name' : 'process_name', 'ph' : 'M', 'pid' : 0,                 'args' : { 'name' : 'kernel' } } )
+
+  return { 'traceEvents' : events, 'displayTimeUnit' : 'ms' }
+
+if ( __name__ == '__main__' ) :
+  parser = argparse.ArgumentParser()
+
+  parser.add_argument( '--file', dest = 'file', action = 'store', default = 'trace.bin' )
+  parser.add_argument( '--text', dest = 'text', action = 'store_true' )
+
+  args = parser.parse_args()
+
+  with open( args.file, 'rb' ) as fd :
+    r = records( fd.read() )
+
+  if( args.text ) :
+    for ( time, type, pid, arg ) in r :
+      print( '%12d %-10s %5d %10d' % ( time, type, pid, arg ) )
+  else :
+    json.dump( chrome( r ), sys.stdout )
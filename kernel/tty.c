@@ -0,0 +1,112 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "tty.h"
+
+tty_t tty[ TTY_COUNT ];
+
+void tty_init() {
+  memset( tty, 0, sizeof( tty ) );
+
+  tty[ 0 ].uart = UART0;
+  tty[ 1 ].uart = UART1;
+
+  for( int i = 0; i < TTY_COUNT; i++ ) {
+    tty[ i ].uart->LCR  |= 0x00000010; // enable FIFOs
+    tty[ i ].uart->IFLS  = 0x00000011; // select receive  level 1/2, transmit level 1/4
+    tty[ i ].uart->ICR   = 0x000007FF; // clear  any pending       interrupts
+    tty[ i ].uart->IMSC |= 0x00000010; // enable receive           interrupt
+    tty[ i ].uart->IMSC |= 0x00000040; // enable receive timeout   interrupt
+  }
+}
+
+tty_t* tty_fd( int fd ) {
+  if     ( fd >= 0 && fd <= 2 ) { // STDIN_FILENO ... STDERR_FILENO
+    return &tty[ 0 ];
+  }
+  else if( fd == 3 ) {            // CONSOLE_FILENO
+    return &tty[ 1 ];
+  }
+
+  return NULL;
+}
+
+int tty_read( tty_t* t, uint8_t* x, int n ) {
+  int r = 0;
+
+  while( r < n && t->rx_tail != t->rx_head ) {
+    x[ r++ ] = t->rx[ t->rx_tail++ & ( TTY_RX_SIZE - 1 ) ];
+  }
+
+  return r;
+}
+
+/* Move as much as possible from the transmit ring into the transmit FIFO;
+ * the transmit interrupt is only enabled while there is something left,
+ * since otherwise it would be raised (for an empty FIFO) indefinitely.
+ */
+
+void tty_tx_fill( tty_t* t ) {
+  while( t->tx_tail != t->tx_head && PL011_can_putc( t->uart ) ) {
+    PL011_putc( t->uart, t->tx[ t->tx_tail++ & ( TTY_TX_SIZE - 1 ) ], false );
+  }
+
+  if( t->tx_tail != t->tx_head ) {
+    t->uart->IMSC |=  0x00000020;     // enable  transmit interrupt
+  }
+  else {
+    t->uart->IMSC &= ~0x00000020;     // disable transmit interrupt
+  }
+}
+
+int tty_write( tty_t* t, const uint8_t* x, int n ) {
+  int r = 0;
+
+  while( r < n && ( t->tx_head - t->tx_tail ) < TTY_TX_SIZE ) {
+    t->tx[ t->tx_head++ & ( TTY_TX_SIZE - 1 ) ] = x[ r++ ];
+  }
+
+  tty_tx_fill( t );
+
+  return r;
+}
+
+/* For a receive (timeout) interrupt, drain the receive FIFO into the
+ * ring, then wake anything waiting to read if there is now data; for a
+ * transmit interrupt, refill the transmit FIFO from the ring, then wake
+ * anything waiting to write if there is now space.
+ */
+
+void tty_irq( tty_t* t ) {
+  uint32_t m = t->uart->MIS;
+
+  if( m & 0x00000050 ) {
+    while( PL011_can_getc( t->uart ) ) {
+      uint8_t x = PL011_getc( t->uart, false );
+
+      if( ( t->rx_head - t->rx_tail ) < TTY_RX_SIZE ) {
+        t->rx[ t->rx_head++ & ( TTY_RX_SIZE - 1 ) ] = x;
+      }
+    }
+
+    t->uart->ICR = 0x00000050;         // clear  receive (timeout) interrupts
+
+    if( t->rx_head != t->rx_tail ) {
+      waitq_wake( &t->rx_wait );
+    }
+  }
+
+  if( m & 0x00000020 ) {
+    t->uart->ICR = 0x00000020;         // clear  transmit          interrupt
+
+    tty_tx_fill( t );
+
+    if( ( t->tx_head - t->tx_tail ) < TTY_TX_SIZE ) {
+      waitq_wake( &t->tx_wait );
+    }
+  }
+}
@@ -0,0 +1,65 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __TTY_H
+#define __TTY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hilevel.h"
+
+/* Each tty couples a PL011 instance with two ring buffers:
+ *
+ * - the receive ring is filled by the receive interrupt and emptied by
+ *   read: a process that reads while it is empty waits on rx_wait, and
+ *   is woken once the interrupt has put something in it (anything that
+ *   is received while it is full is dropped), and
+ * - the transmit ring is filled by write and emptied into the transmit
+ *   FIFO, both straight away and then by the transmit interrupt each
+ *   time the FIFO drains below the trigger level: write only waits, on
+ *   tx_wait, if the ring is full, so it takes the same time whatever
+ *   the baud rate.
+ *
+ * The indices are free-running, so each ring holds ( head - tail ) bytes,
+ * which is at most the (power of 2) ring size.
+ *
+ * There are two ttys: UART0 serves the standard file descriptors, and
+ * UART1 serves the console (i.e., file descriptor 3).
+ */
+
+#define TTY_COUNT   (   2 )
+#define TTY_RX_SIZE ( 256 )
+#define TTY_TX_SIZE ( 1024 )
+
+typedef struct {
+  PL011_t* uart;
+  uint8_t  rx[ TTY_RX_SIZE ];
+  uint32_t rx_head;           // next byte written by the interrupt handler
+  uint32_t rx_tail;           // next byte read    by read
+  waitq_t  rx_wait;           // processes waiting for something to read
+  uint8_t  tx[ TTY_TX_SIZE ];
+  uint32_t tx_head;           // next byte written by write
+  uint32_t tx_tail;           // next byte sent    to the transmit FIFO
+  waitq_t  tx_wait;           // processes waiting for space to write
+} tty_t;
+
+extern tty_t tty[ TTY_COUNT ];
+
+// initialise the ttys, enabling the FIFOs and receive interrupts of each UART
+extern void   tty_init();
+// find the tty for file descriptor fd, or NULL if there is none
+extern tty_t* tty_fd( int fd );
+// read at most n bytes into x from tty t without blocking; return bytes read
+extern int    tty_read( tty_t* t, uint8_t* x, int n );
+// write at most n bytes from x to   tty t without blocking; return bytes written
+extern int    tty_write( tty_t* t, const uint8_t* x, int n );
+// handle an interrupt from the UART of tty t
+extern void   tty_irq( tty_t* t );
+
+#endif
@@ -27,7 +27,7 @@ void main_P3() {
   open(pipeID);
 
   while( 1 ) {
-    write( STDOUT_FILENO, "P3", 2 );
+    fputs( "P3", stdout );
 
     uint32_t lo = 1 <<  8;
     uint32_t hi = 1 << 24;
@@ -14,4 +14,7 @@
 
 #include "libc.h"
 
+// return the Hamming weight of x, i.e., the number of bits set
+extern uint32_t weight( uint32_t x );
+
 #endif
@@ -21,7 +21,7 @@ uint32_t gcd( uint32_t x, uint32_t y ) {
 
 void main_P4() {
   while( 1 ) {
-    write( STDOUT_FILENO, "P4", 2 );
+    fputs( "P4", stdout );
 
     uint32_t lo = 1 <<  4;
     uint32_t hi = 1 <<  8;
@@ -23,7 +23,7 @@ int is_prime( uint32_t x ) {
 
 void main_P5() {
   for( int i = 0; i < 50; i++ ) {
-    write( STDOUT_FILENO, "P5", 2 );
+    fputs( "P5", stdout );
 
     uint32_t lo = 1 <<  8;
     uint32_t hi = 1 << 16;
@@ -0,0 +1,261 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "Pbench.h"
+
+/* Each benchmark measures the cost of some kernel primitive, in cycles,
+ * then reports it via the console terminal as one line of the form
+ *
+ * bench <name> n=<samples> min=<cycles> p50=<cycles> p90=<cycles> p99=<cycles> max=<cycles> ops/s=<rate>
+ *
+ * with the rate derived from the mean, and a final line "bench done";
+ * user/bench.py parses this (so the formats must match).  Note that the
+ * numbers are only reproducible if nothing else is executing.
+ */
+
+#define BENCH_N     ( 1000 )
+#define BENCH_FORKS (   100 ) // more than there are process slots, so they are reused
+#define BENCH_BYTES ( 65536 )
+#define BENCH_CHUNK (   512 )
+#define BENCH_SPIN  ( CPU_HZ / 2 )
+
+uint32_t   bench_sample[ BENCH_N ];
+
+void bench_sort( uint32_t* x, int n ) {
+  for( int i = 1; i < n; i++ ) {
+    uint32_t t = x[ i ]; int j = i;
+
+    for( ; j > 0 && x[ j - 1 ] > t; j-- ) {
+      x[ j ] = x[ j - 1 ];
+    }
+
+    x[ j ] = t;
+  }
+}
+
+void bench_report( FILE* f, char* name, uint32_t* x, int n ) {
+  if( n == 0 ) {
+    fprintf( f, "bench %s n=0\n", name ); fflush( f ); return;
+  }
+
+  bench_sort( x, n ); uint64_t s = 0;
+
+  for( int i = 0; i < n; i++ ) {
+    s += x[ i ];
+  }
+
+  uint32_t m = s / n;
+
+  fprintf( f, "bench %s n=%d min=%u p50=%u p90=%u p99=%u max=%u ops/s=%u\n", name, n,
+           x[ 0 ], x[ ( ( n - 1 ) * 50 ) / 100 ], x[ ( ( n - 1 ) * 90 ) / 100 ], x[ ( ( n - 1 ) * 99 ) / 100 ], x[ n - 1 ],
+           ( m == 0 ) ? 0 : ( CPU_HZ / m ) );
+  fflush( f );
+}
+
+// the program each child of the fork and spawn benchmarks executes
+void main_Pbench_exit() {
+  exit( EXIT_SUCCESS );
+}
+
+// a null system call, i.e., as little work as possible in the kernel
+void bench_null( FILE* f ) {
+  for( int i = 0; i < BENCH_N; i++ ) {
+    uint32_t t = cycles(); getpid(); bench_sample[ i ] = cycles() - t;
+  }
+
+  bench_report( f, "null", bench_sample, BENCH_N );
+}
+
+// a yield with nothing else READY, i.e., through the scheduler but without a switch
+void bench_yield( FILE* f ) {
+  for( int i = 0; i < BENCH_N; i++ ) {
+    uint32_t t = cycles(); yield(); bench_sample[ i ] = cycles() - t;
+  }
+
+  bench_report( f, "yield", bench_sample, BENCH_N );
+}
+
+// a context switch, i.e., half a round trip between two processes that yield to each other
+void bench_switch( FILE* f ) {
+  pid_t pid = fork();
+
+  if( 0 == pid ) {
+    for( int i = 0; i < BENCH_N; i++ ) {
+      yield();
+    }
+
+    exit( EXIT_SUCCESS );
+  }
+
+  yield(); // let the child start
+
+  for( int i = 0; i < BENCH_N; i++ ) {
+    uint32_t t = cycles(); yield(); bench_sample[ i ] = ( cycles() - t ) / 2;
+  }
+
+  waitpid( pid, NULL, 0 );
+
+  bench_report( f, "switch", bench_sample, BENCH_N );
+}
+
+// a fork, exec and exit, until the parent collects the child's exit status
+void bench_fork( FILE* f ) {
+  for( int i = 0; i < BENCH_FORKS; i++ ) {
+    uint32_t t = cycles(); pid_t pid = fork();
+
+    if( 0 == pid ) {
+      exec( &main_Pbench_exit );
+    }
+
+    waitpid( pid, NULL, 0 );
+
+    bench_sample[ i ] = cycles() - t;
+  }
+
+  bench_report( f, "fork", bench_sample, BENCH_FORKS );
+}
+
+// a spawn and exit, until the parent collects the child's exit status, for comparison with fork
+void bench_spawn( FILE* f ) {
+  for( int i = 0; i < BENCH_FORKS; i++ ) {
+    uint32_t t = cycles(); pid_t pid = spawn( &main_Pbench_exit, 0, 0 );
+
+    waitpid( pid, NULL, 0 );
+
+    bench_sample[ i ] = cycles() - t;
+  }
+
+  bench_report( f, "spawn", bench_sample, BENCH_FORKS );
+}
+
+// a 1-byte round trip between two processes via a pair of pipes
+void bench_pipe_latency( FILE* f ) {
+  int a = pipe(), b = pipe(); char x = 0; pid_t pid = fork();
+
+  if( 0 == pid ) {
+    for( int i = 0; i < BENCH_N; i++ ) {
+      read( a, &x, 1 ); write( b, &x, 1 );
+    }
+
+    exit( EXIT_SUCCESS );
+  }
+
+  for( int i = 0; i < BENCH_N; i++ ) {
+    uint32_t t = cycles(); write( a, &x, 1 ); read( b, &x, 1 ); bench_sample[ i ] = cycles() - t;
+  }
+
+  waitpid( pid, NULL, 0 ); close( a ); close( b );
+
+  bench_report( f, "pipe", bench_sample, BENCH_N );
+}
+
+// an uncontended mutex lock and unlock, i.e., just LDREX/STREX with no system call
+void bench_mutex( FILE* f ) {
+  mutex_t m = MUTEX_INITIALIZER;
+
+  for( int i = 0; i < BENCH_N; i++ ) {
+    uint32_t t = cycles(); mutex_lock( &m ); mutex_unlock( &m ); bench_sample[ i ] = cycles() - t;
+  }
+
+  bench_report( f, "mutex", bench_sample, BENCH_N );
+}
+
+sem_t bench_ping, bench_pong;
+
+void* bench_futex_thread( void* x ) {
+  for( int i = 0; i < BENCH_N; i++ ) {
+    sem_wait( &bench_ping ); sem_post( &bench_pong );
+  }
+
+  return NULL;
+}
+
+// a round trip between two threads via a pair of semaphores, each of which has to wait (and so wake the other)
+void bench_futex( FILE* f ) {
+  sem_init( &bench_ping, 0 );
+  sem_init( &bench_pong, 0 );
+
+  pid_t tid = thread_create( &bench_futex_thread, NULL, 0 );
+
+  for( int i = 0; i < BENCH_N; i++ ) {
+    uint32_t t = cycles(); sem_post( &bench_ping ); sem_wait( &bench_pong ); bench_sample[ i ] = cycles() - t;
+  }
+
+  thread_join( tid, NULL );
+
+  bench_report( f, "futex", bench_sample, BENCH_N );
+}
+
+// streaming BENCH_BYTES from one process to another via a pipe, BENCH_CHUNK bytes at a time
+void bench_pipe_throughput( FILE* f ) {
+  int a = pipe(); char x[ BENCH_CHUNK ]; pid_t pid = fork();
+
+  if( 0 == pid ) {
+    for( int i = 0; i < BENCH_BYTES; i += BENCH_CHUNK ) {
+      write( a, x, BENCH_CHUNK );
+    }
+
+    exit( EXIT_SUCCESS );
+  }
+
+  uint32_t t = cycles();
+
+  for( int i = 0; i < BENCH_BYTES; ) {
+    i += read( a, x, BENCH_CHUNK );
+  }
+
+  t = cycles() - t;
+
+  waitpid( pid, NULL, 0 ); close( a );
+
+  fprintf( f, "bench pipe_bw bytes=%u cycles=%u bytes/s=%u\n", BENCH_BYTES, t,
+           ( uint32_t )( ( ( uint64_t )( BENCH_BYTES ) * CPU_HZ ) / t ) );
+  fflush( f );
+}
+
+// the entry latency of timer interrupts, as recorded by the kernel while two processes with short slices compete
+void bench_irq( FILE* f ) {
+  nice( getpid(), 19 );
+
+  pid_t pid = fork();
+
+  if( 0 == pid ) {
+    while( 1 ) {
+      // spin
+    }
+  }
+
+  uint32_t t = cycles();
+
+  while( ( cycles() - t ) < BENCH_SPIN ) {
+    // spin
+  }
+
+  kill( pid, SIG_TERM ); waitpid( pid, NULL, 0 );
+  nice( getpid(),  0 );
+
+  bench_report( f, "irq", bench_sample, irq_latency( bench_sample, BENCH_N ) );
+}
+
+void main_Pbench() {
+  FILE f = { CONSOLE_FILENO, _IOLBF, 0 };
+
+  bench_null( &f );
+  bench_yield( &f );
+  bench_switch( &f );
+  bench_fork( &f );
+  bench_spawn( &f );
+  bench_pipe_latency( &f );
+  bench_pipe_throughput( &f );
+  bench_mutex( &f );
+  bench_futex( &f );
+  bench_irq( &f );
+
+  fprintf( &f, "bench done\n" ); fflush( &f );
+
+  exit( EXIT_SUCCESS );
+}
@@ -0,0 +1,20 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#ifndef __Pbench_H
+#define __Pbench_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libc.h"
+
+// report the distribution of n samples (in cycles) in x as one line of output to f, per user/bench.py
+extern void bench_report( FILE* f, char* name, uint32_t* x, int n );
+
+#endif
@@ -0,0 +1,95 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "Pmalloc.h"
+
+/* Each benchmark measures the cost of malloc and free, in cycles, and is
+ * reported in the same way as those in Pbench (so user/bench.py can parse
+ * them, via make bench-malloc):
+ *
+ * - the latency of a malloc and free pair for a small, large and huge
+ *   block in turn (which, once warmed up, just reuse the same block), then
+ * - the throughput of a random mix of sizes, with PMALLOC_LIVE blocks live
+ *   at once, each operation freeing a random one and allocating another.
+ */
+
+#define PMALLOC_N     ( 1000 )
+#define PMALLOC_LIVE  (  256 )
+#define PMALLOC_OPS   ( 20000 )
+
+uint32_t pmalloc_sample[ PMALLOC_N ];
+void*    pmalloc_live[ PMALLOC_LIVE ];
+uint32_t pmalloc_seed = 1;
+
+uint32_t pmalloc_rand() {
+  pmalloc_seed = ( pmalloc_seed * 1103515245 ) + 12345; return pmalloc_seed >> 8;
+}
+
+// a size in the mix: mostly small, some large, and very few huge
+size_t pmalloc_size() {
+  uint32_t r = pmalloc_rand();
+
+  switch( r % 64 ) {
+    case  0 : return MALLOC_HUGE + ( r % MALLOC_HUGE );
+    case  1 :
+    case  2 :
+    case  3 :
+    case  4 : return MALLOC_SMALL + ( r % ( 16 * 1024 ) );
+    default : return 1 + ( r % MALLOC_SMALL );
+  }
+}
+
+void pmalloc_pair( FILE* f, char* name, size_t n, int k ) {
+  free( malloc( n ) ); // warm up, i.e., refill or grow as need be
+
+  for( int i = 0; i < k; i++ ) {
+    uint32_t t = cycles(); free( malloc( n ) ); pmalloc_sample[ i ] = cycles() - t;
+  }
+
+  bench_report( f, name, pmalloc_sample, k );
+}
+
+void pmalloc_mixed( FILE* f ) {
+  for( int i = 0; i < PMALLOC_LIVE; i++ ) {
+    pmalloc_live[ i ] = malloc( pmalloc_size() );
+  }
+
+  uint32_t t = cycles(), fails = 0;
+
+  for( int i = 0; i < PMALLOC_OPS; i++ ) {
+    int j = pmalloc_rand() % PMALLOC_LIVE;
+
+    free( pmalloc_live[ j ] );
+
+    if( ( pmalloc_live[ j ] = malloc( pmalloc_size() ) ) == NULL ) {
+      fails++;
+    }
+  }
+
+  t = cycles() - t;
+
+  for( int i = 0; i < PMALLOC_LIVE; i++ ) {
+    free( pmalloc_live[ i ] );
+  }
+
+  fprintf( f, "bench malloc_mixed ops=%u fails=%u cycles=%u ops/s=%u\n", PMALLOC_OPS, fails, t,
+           ( uint32_t )( ( ( uint64_t )( PMALLOC_OPS ) * CPU_HZ ) / t ) );
+  fflush( f );
+}
+
+void main_Pmalloc() {
+  FILE f = { CONSOLE_FILENO, _IOLBF, 0 };
+
+  pmalloc_pair( &f, "malloc_small",                     32, PMALLOC_N       );
+  pmalloc_pair( &f, "malloc_large", MALLOC_SMALL  + 1024, PMALLOC_N       );
+  pmalloc_pair( &f, "malloc_huge",  MALLOC_HUGE   * 2,    PMALLOC_N / 10  );
+  pmalloc_mixed( &f );
+
+  fprintf( &f, "bench done\n" ); fflush( &f );
+
+  exit( EXIT_SUCCESS );
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "Pstdio.h"
+
+/* Output the same text, using the same sequence of calls, to stdout in a
+ * given stdio mode, and count the number of traps (i.e., write system
+ * calls) this takes: the text is PSTDIO_LINES lines, each of PSTDIO_WORDS
+ * 2-byte words, which is what P3, P4 and P5 output in their loops.
+ */
+
+#define PSTDIO_LINES ( 16 )
+#define PSTDIO_WORDS ( 32 )
+
+uint32_t stdio_traps( int x ) {
+  setvbuf( stdout, NULL, x, BUFSIZ );
+
+  uint32_t t = tls()->writes;
+
+  for( int i = 0; i < PSTDIO_LINES; i++ ) {
+    for( int j = 0; j < PSTDIO_WORDS; j++ ) {
+      fputs( "Px", stdout );
+    }
+
+    fputc( '\x0A', stdout );
+  }
+
+  fflush( stdout );
+
+  return tls()->writes - t;
+}
+
+void main_Pstdio() {
+  uint32_t n = stdio_traps( _IONBF );
+  uint32_t l = stdio_traps( _IOLBF );
+  uint32_t f = stdio_traps( _IOFBF );
+
+  setvbuf( stdout, NULL, _IOLBF, BUFSIZ );
+
+  printf( "unbuffered     : %4u traps\n",                 n        );
+  printf( "line  buffered : %4u traps (%u fewer)\n",      l, n - l );
+  printf( "fully buffered : %4u traps (%u fewer)\n",      f, n - f );
+
+  exit( EXIT_SUCCESS );
+}
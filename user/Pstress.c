@@ -0,0 +1,141 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "Pstress.h"
+
+/* Fork and kill children at random for PSTRESS_ROUNDS rounds, checking the
+ * kernel's PID index stays consistent throughout, i.e., that
+ *
+ * - nice succeeds for every live child (as does kill, when it is chosen to
+ *   be killed, since any signal terminates a process),
+ * - kill and nice fail for each of the last PSTRESS_DEAD children to have
+ *   been killed (and waited for), and
+ * - ps reports exactly the live children, plus whatever was there before.
+ *
+ * The index is only exercised properly once its probe sequences collide,
+ * so this is meant to be run (via make stress) in a kernel built with a
+ * small index, in which every insertion or removal shifts entries about.
+ * It reports, per Pbench, one line of the form
+ *
+ * bench stress rounds=<n> forks=<n> kills=<n> full=<n> errors=<n>
+ *
+ * then "bench done", and exits with EXIT_FAILURE if there were any errors.
+ * Nothing else should be executed meanwhile, since ps would show it too.
+ */
+
+#define PSTRESS_ROUNDS ( 2000 )
+#define PSTRESS_LIVE   (   32 )
+#define PSTRESS_DEAD   (   64 )
+#define PSTRESS_PS     (  256 )
+
+pid_t      pstress_live[ PSTRESS_LIVE ];
+pid_t      pstress_dead[ PSTRESS_DEAD ];
+procinfo_t pstress_ps[ PSTRESS_PS ];
+uint32_t   pstress_seed = 1;
+
+int pstress_n = 0, pstress_k = 0, pstress_errors = 0;
+
+uint32_t pstress_rand() {
+  pstress_seed = ( pstress_seed * 1103515245 ) + 12345; return pstress_seed >> 8;
+}
+
+void pstress_error( FILE* f, char* x, pid_t pid ) {
+  fprintf( f, "stress error: %s (pid=%d)\n", x, pid ); fflush( f ); pstress_errors++;
+}
+
+// check ps reports every live child, and nothing else other than the processes in b (i.e., that were there before)
+void pstress_check_ps( FILE* f, procinfo_t* b, int m ) {
+  int n = ps( pstress_ps, PSTRESS_PS ), c = 0;
+
+  for( int i = 0; i < n; i++ ) {
+    bool r = false;
+
+    for( int j = 0; j < m && !r; j++ ) {
+      r = ( pstress_ps[ i ].pid == b[ j ].pid );
+    }
+    for( int j = 0; j < pstress_n && !r; j++ ) {
+      r = ( pstress_ps[ i ].pid == pstress_live[ j ] ); c += r ? 1 : 0;
+    }
+
+    if( !r ) {
+      pstress_error( f, "ps reports an unexpected process", pstress_ps[ i ].pid );
+    }
+  }
+
+  if( c != pstress_n ) {
+    pstress_error( f, "ps misses a live process", -1 );
+  }
+}
+
+void main_Pstress() {
+  FILE f = { CONSOLE_FILENO, _IOLBF, 0 };
+
+  procinfo_t b[ 8 ]; int m = ps( b, 8 ), forks = 0, kills = 0, full = 0;
+
+  for( int r = 0; r < PSTRESS_ROUNDS; r++ ) {
+    if( pstress_n == 0 || ( pstress_n < PSTRESS_LIVE && ( pstress_rand() & 1 ) ) ) {
+      pid_t pid = fork();
+
+      if( 0 == pid ) {
+        while( 1 ) { // either runnable or waiting, so kill has to take it out of either kind of queue
+          if( getpid() & 1 ) {
+            yield();
+          }
+          else {
+            sleep( 1000 );
+          }
+        }
+      }
+      else if( pid < 0 ) {
+        full++; // the process table is full, which is fine
+      }
+      else {
+        pstress_live[ pstress_n++ ] = pid; forks++;
+      }
+    }
+    else {
+      int   i   = pstress_rand() % pstress_n;
+      pid_t pid = pstress_live[ i ];
+      int   s   = 0;
+
+      pstress_live[ i ] = pstress_live[ --pstress_n ];
+
+      if( kill( pid, SIG_TERM ) != 0 ) {
+        pstress_error( &f, "kill failed for a live process", pid );
+      }
+      if( waitpid( pid, &s, 0 ) != pid || s != EXIT_KILLED ) {
+        pstress_error( &f, "waitpid failed for a killed process", pid );
+      }
+
+      pstress_dead[ pstress_k++ % PSTRESS_DEAD ] = pid; kills++;
+    }
+
+    for( int i = 0; i < pstress_n; i++ ) {
+      if( nice( pstress_live[ i ], pstress_rand() % 20 ) != 0 ) {
+        pstress_error( &f, "nice failed for a live process", pstress_live[ i ] );
+      }
+    }
+    for( int i = 0; i < pstress_k && i < PSTRESS_DEAD; i++ ) {
+      if( nice( pstress_dead[ i ], 0 ) != -1 || kill( pstress_dead[ i ], SIG_TERM ) != -1 ) {
+        pstress_error( &f, "nice or kill succeeded for a dead process", pstress_dead[ i ] );
+      }
+    }
+
+    pstress_check_ps( &f, b, m );
+  }
+
+  while( pstress_n > 0 ) {
+    pid_t pid = pstress_live[ --pstress_n ];
+
+    kill( pid, SIG_TERM ); waitpid( pid, NULL, 0 );
+  }
+
+  fprintf( &f, "bench stress rounds=%d forks=%d kills=%d full=%d errors=%d\n", PSTRESS_ROUNDS, forks, kills, full, pstress_errors );
+  fprintf( &f, "bench done\n" ); fflush( &f );
+
+  exit( ( pstress_errors == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE );
+}
@@ -8,12 +8,9 @@
 #include "Ptemp.h"
 
 void main_Ptemp() {
-  int x = 0;
   while( 1 ) {
-    if(x%6000 == 0) {  //used to be %20
-      write( STDOUT_FILENO, "Ptemp", 5 );
-    }
-  x++;
+    write( STDOUT_FILENO, "Ptemp", 5 );
+    sleep( 1000 ); //wait rather than spin between writes
   }
 
   exit( EXIT_SUCCESS );
@@ -0,0 +1,64 @@
+/* Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+ *
+ * Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+ * which can be found via http://creativecommons.org (and should be included as
+ * LICENSE.txt within the associated archive or repository).
+ */
+
+#include "Pthread.h"
+
+/* The same computation as P3, i.e., the Hamming weight of every x in the
+ * range [ PTHREAD_LO, PTHREAD_HI ), first by one thread then split evenly
+ * between 1, 2, ... PTHREAD_MAX threads; each piece writes its sum into
+ * an array, which every thread shares, and is then joined.  The totals
+ * should match, and the cycles taken show the overhead of the split.
+ */
+
+#define PTHREAD_LO  ( 1 <<  8 )
+#define PTHREAD_HI  ( 1 << 20 )
+#define PTHREAD_MAX ( 8 )
+
+typedef struct {
+  uint32_t lo, hi;
+  uint32_t r;
+} pthread_piece_t;
+
+pthread_piece_t pthread_piece[ PTHREAD_MAX ];
+
+void* pthread_weight( void* x ) {
+  pthread_piece_t* p = ( pthread_piece_t* )( x );
+
+  p->r = 0;
+
+  for( uint32_t y = p->lo; y < p->hi; y++ ) {
+    p->r += weight( y );
+  }
+
+  return NULL;
+}
+
+void main_Pthread() {
+  pid_t t[ PTHREAD_MAX ];
+
+  for( int n = 1; n <= PTHREAD_MAX; n *= 2 ) {
+    uint32_t c = cycles(), r = 0;
+
+    for( int i = 0; i < n; i++ ) {
+      pthread_piece[ i ].lo = PTHREAD_LO + ( ( ( PTHREAD_HI - PTHREAD_LO ) / n ) *   i       );
+      pthread_piece[ i ].hi = ( i == ( n - 1 ) ) ? PTHREAD_HI :
+                              PTHREAD_LO + ( ( ( PTHREAD_HI - PTHREAD_LO ) / n ) * ( i + 1 ) );
+
+      if( ( t[ i ] = thread_create( &pthread_weight, &pthread_piece[ i ], 0 ) ) < 0 ) {
+        printf( "thread_create failed\n" ); exit( EXIT_FAILURE );
+      }
+    }
+
+    for( int i = 0; i < n; i++ ) {
+      thread_join( t[ i ], NULL ); r += pthread_piece[ i ].r;
+    }
+
+    printf( "threads=%d weight=%u cycles=%u\n", n, r, cycles() - c );
+  }
+
+  exit( EXIT_SUCCESS );
+}
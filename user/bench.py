@@ -0,0 +1,119 @@
+# Copyright (C) 2017 Daniel Page <csdsp@bristol.ac.uk>
+#
+# Use of this source code is restricted per the CC BY-NC-ND license, a copy of
+# which can be found via http://creativecommons.org (and should be included as
+# LICENSE.txt within the associated archive or repository).
+
+import argparse, json, socket, subprocess, sys, time
+
+# Boot the kernel image headless under QEMU (with -icount, so the guest
+# clocks are derived from the number of instructions executed, and hence
+# the results are reproducible), execute the benchmark program via the
+# console, then collect the results it reports.  Each result line has the
+# form
+#
+# bench <name> <key>=<value> ...
+#
+# per user/Pbench.c (or whichever benchmark program is executed, e.g., user/
+# Pmalloc.c), and the results are written as JSON, i.e., as
+#
+# { "commit" : <git commit>, "icount" : <icount>, "results" : { <name> : { <key> : <value>, ... }, ... } }
+
+def connect( host, port, timeout ) :
+  limit = time.time() + timeout
+
+  while( True ) :
+    try :
+      return socket.create_connection( ( host, port ) )
+    except socket.error :
+      if( time.time() > limit ) :
+        raise
+
+      time.sleep( 0.1 )
+
+def parse( line ) :
+  tokens = line.split()
+
+  if( len( tokens ) < 2 or tokens[ 0 ] != 'bench' ) :
+    return None
+
+  r = {}
+
+  for token in tokens[ 2 : ] :
+    ( key, _, value ) = token.partition( '=' )
+
+    try :
+      r[ key ] = int( value )
+    except ValueError :
+      r[ key ] =      value
+
+  return ( tokens[ 1 ], r )
+
+def commit() :
+  try :
+    return subprocess.check_output( [ 'git', 'rev-parse', 'HEAD' ] ).decode().strip()
+  except ( OSError, subprocess.CalledProcessError ) :
+    return None
+
+if ( __name__ == '__main__' ) :
+  parser = argparse.ArgumentParser()
+
+  parser.add_argument( '--qemu',    dest = 'qemu',    action = 'store', default = 'qemu-system-arm' )
+  parser.add_argument( '--kernel',  dest = 'kernel',  action = 'store', default = 'image.bin'       )
+  parser.add_argument( '--program', dest = 'program', action = 'store', default = 'Pbench'          )
+  parser.add_argument( '--icount',  dest = 'icount',  action = 'store', default = 'shift=1'         )
+  parser.add_argument( '--host',    dest = 'host',    action = 'store', default = '127.0.0.1'       )
+  parser.add_argument( '--port',    dest = 'port',    action = 'store', default = 1237, type = int  )
+  parser.add_argument( '--log',     dest = 'log',     action = 'store', default = 'bench.log'       )
+  parser.add_argument( '--output',  dest = 'output',  action = 'store', default = 'bench.json'      )
+  parser.add_argument( '--timeout', dest = 'timeout', action = 'store', default = 600,  type = int  )
+
+  args = parser.parse_args()
+
+  # UART0 (i.e., stdout, plus any kernel debug output) goes to the log, UART1
+  # (i.e., the console) to a socket, and UART2 and UART3 are discarded.
+
+  qemu = subprocess.Popen( [ args.qemu, '-M', 'realview-pb-a8', '-m', '128M', '-display', 'none', '-icount', args.icount,
+                             '-serial', 'file:%s' % ( args.log ),
+                             '-serial', 'telnet:%s:%d,server' % ( args.host, args.port ),
+                             '-serial', 'null',
+                             '-serial', 'null',
+                             '-kernel', args.kernel ] )
+
+  results = {} ; done = False
+
+  try :
+    console = connect( args.host, args.port, 10 ) ; console.settimeout( args.timeout )
+
+    console.sendall( ( 'execute %s\n' % ( args.program ) ).encode( 'ascii' ) )
+
+    data  = b''
+    limit = time.time() + args.timeout
+
+    while( not done and time.time() < limit ) :
+      chunk = console.recv( 4096 )
+
+      if( not chunk ) :
+        break
+
+      data += chunk
+
+      while( b'\n' in data ) :
+        ( line, _, data ) = data.partition( b'\n' )
+
+        r = parse( line.decode( 'ascii', 'replace' ) )
+
+        if  ( r == None       ) :
+          continue
+        elif( r[ 0 ] == 'done' ) :
+          done = True ; break
+        else :
+          results[ r[ 0 ] ] = r[ 1 ] ; sys.stderr.write( line.decode( 'ascii', 'replace' ) + '\n' )
+  finally :
+    qemu.kill() ; qemu.wait()
+
+  with open( args.output, 'w' ) as fd :
+    json.dump( { 'commit' : commit(), 'icount' : args.icount, 'results' : results }, fd, indent = 2, sort_keys = True )
+
+  if( not done ) :
+    sys.stderr.write( 'benchmarks did not complete\n' ) ; sys.exit( 1 )
@@ -8,19 +8,19 @@
 #include "console.h"
 
 /* The following functions are special-case versions of a) writing, and
- * b) reading a string from the UART (the latter case returning once a
- * carriage return character has been read, or a limit is reached).
+ * b) reading a string from the console terminal (the latter case returning
+ * once a carriage return character has been read, or a limit is reached).
+ * Reading blocks in the kernel until something has been typed, so the
+ * console uses no processor time while waiting for a command.
  */
 
 void puts( char* x, int n ) {
-  for( int i = 0; i < n; i++ ) {
-    PL011_putc( UART1, x[ i ], true );
-  }
+  write( CONSOLE_FILENO, x, n );
 }
 
 void gets( char* x, int n ) {
   for( int i = 0; i < n; i++ ) {
-    x[ i ] = PL011_getc( UART1, true );
+    read( CONSOLE_FILENO, &x[ i ], 1 );
 
     if( x[ i ] == '\x0A' ) {
       x[ i ] = '\x00'; break;
@@ -37,6 +37,11 @@ void gets( char* x, int n ) {
 extern void main_P3();
 extern void main_P4();
 extern void main_P5();
+extern void main_Pstdio();
+extern void main_Pbench();
+extern void main_Pmalloc();
+extern void main_Pthread();
+extern void main_Pstress();
 
 void* load( char* x ) {
   if     ( 0 == strcmp( x, "P3" ) ) {
@@ -48,10 +53,122 @@ void* load( char* x ) {
   else if( 0 == strcmp( x, "P5" ) ) {
     return &main_P5;
   }
+  else if( 0 == strcmp( x, "Pstdio" ) ) {
+    return &main_Pstdio;
+  }
+  else if( 0 == strcmp( x, "Pbench" ) ) {
+    return &main_Pbench;
+  }
+  else if( 0 == strcmp( x, "Pmalloc" ) ) {
+    return &main_Pmalloc;
+  }
+  else if( 0 == strcmp( x, "Pthread" ) ) {
+    return &main_Pthread;
+  }
+  else if( 0 == strcmp( x, "Pstress" ) ) {
+    return &main_Pstress;
+  }
 
   return NULL;
 }
 
+/* The following functions list the processes, either once (ps) or every
+ * second for a number of iterations (top), via a FILE which buffers output
+ * to the console terminal.  CPU share is the time (in USR mode or in the
+ * kernel) used by a process since the last iteration, as a fraction of
+ * the time used by every process, the idle task included.
+ */
+
+#define PS_MAX ( 32 )
+
+procinfo_t ps_prev[ PS_MAX ];
+procinfo_t ps_next[ PS_MAX ];
+
+char* ps_status( int x ) {
+  switch( x ) {
+    case PROC_CREATED   : return "created  ";
+    case PROC_READY     : return "ready    ";
+    case PROC_EXECUTING : return "executing";
+    case PROC_WAITING   : return "waiting  ";
+    case PROC_TERMINATED: return "zombie   ";
+    default             : return "?        ";
+  }
+}
+
+void ps_show( FILE* f ) {
+  int n = ps( ps_next, PS_MAX );
+
+  fprintf( f, "  PID STATUS    NICE     UTIME     STIME     VCSW    IVCSW SYSCALLS\n" );
+
+  for( int i = 0; i < n; i++ ) {
+    procinfo_t* p = &ps_next[ i ];
+
+    fprintf( f, "%5d %s %4d %7ums %7ums %8u %8u %8u\n", p->pid, ps_status( p->status ), p->nice, p->utime / 1000, p->stime / 1000, p->nvcsw, p->nivcsw, p->syscalls );
+  }
+
+  fflush( f );
+}
+
+void top_show( FILE* f, int k ) {
+  int m = ps( ps_prev, PS_MAX );
+
+  for( int i = 0; i < k; i++ ) {
+    sleep( 1000 );
+
+    int n = ps( ps_next, PS_MAX ); uint32_t d[ PS_MAX ], t = 0;
+
+    for( int j = 0; j < n; j++ ) {
+      procinfo_t* p = &ps_next[ j ]; d[ j ] = p->utime + p->stime;
+
+      for( int l = 0; l < m; l++ ) {
+        if( ps_prev[ l ].pid == p->pid ) {
+          d[ j ] -= ps_prev[ l ].utime + ps_prev[ l ].stime; break;
+        }
+      }
+
+      t += d[ j ];
+    }
+
+    fprintf( f, "\n  PID STATUS    NICE   %%CPU     VCSW    IVCSW SYSCALLS\n" );
+
+    for( int j = 0; j < n; j++ ) {
+      procinfo_t* p = &ps_next[ j ]; uint32_t s = ( t == 0 ) ? 0 : ( uint32_t )( ( ( uint64_t )( d[ j ] ) * 1000 ) / t );
+
+      fprintf( f, "%5d %s %4d %4u.%u %8u %8u %8u\n", p->pid, ps_status( p->status ), p->nice, s / 10, s % 10, p->nvcsw, p->nivcsw, p->syscalls );
+    }
+
+    fflush( f );
+
+    memcpy( ps_prev, ps_next, n * sizeof( procinfo_t ) ); m = n;
+  }
+}
+
+/* The following function lists the usage of kernel memory: the page
+ * allocator first, then each slab cache.
+ */
+
+#define KMEM_MAX ( 8 )
+
+kmeminfo_t kmem_info[ KMEM_MAX ];
+
+void kmem_show( FILE* f ) {
+  int n = kmem( kmem_info, KMEM_MAX );
+
+  fprintf( f, "NAME     SIZE  INUSE  TOTAL  SLABS   ALLOCS  FAILS\n" );
+
+  for( int i = 0; i < n; i++ ) {
+    kmeminfo_t* p = &kmem_info[ i ]; int w = fprintf( f, "%s", p->name );
+
+    for( ; w < 8; w++ ) {
+      fputc( ' ', f );
+    }
+
+    fprintf( f, "%4u %6u %6u %6u %8u %6u\n", p->size, p->inuse, p->total, p->slabs, p->allocs, p->fails );
+  }
+
+  fflush( f );
+}
+
 /* The behaviour of a console process can be summarised as an infinite
  * loop over three main steps, namely
  *
@@ -63,14 +180,23 @@ void* load( char* x ) {
  *
  * a. execute <program name>
  *
- *    This command will use fork to create a new process; the parent
- *    (i.e., the console) will continue as normal, whereas the child
- *    uses exec to replace the process image and thereby execute a
- *    different (named) program.  For example,
+ *    This command will use spawn to create a new process, which
+ *    executes a different (named) program from the start, with a fresh
+ *    stack, whereas the console will continue as normal.  (This is
+ *    cheaper than the classic fork then exec, since nothing of the
+ *    console has to be duplicated only to be discarded again.)  Once
+ *    the process has exited, the console collects its exit status (via
+ *    waitpid) and reports it, before the next prompt.  For example,
  *
  *    execute P3
  *
- *    would execute the user program named P3.
+ *    would execute the user program named P3.  An optional stack size
+ *    (in KiB) can follow the program name, for a program that needs
+ *    more than the default 4KiB (e.g., P4, which recurses), so
+ *
+ *    execute P4 16
+ *
+ *    would execute P4 with a 16KiB stack.
  *
  * b. terminate <process ID>
  *
@@ -82,19 +208,68 @@ void* load( char* x ) {
  *    terminate 3
  *
  *    would terminate the process whose PID is 3.
+ *
+ * c. nice <process ID> <nice value>
+ *
+ *    This command uses nice to change the static priority of a specific
+ *    process (identified via the PID provided), which ranges from -20
+ *    (highest) to 19 (lowest).  For example,
+ *
+ *    nice 3 10
+ *
+ *    would lower the priority of the process whose PID is 3.
+ *
+ * d. ps
+ *
+ *    This command lists every process (the idle task included, as PID
+ *    0), with the time it has spent executing in USR mode and in the
+ *    kernel, how many times it has given up the processor voluntarily
+ *    or otherwise, and how many system calls it has made.
+ *
+ * e. top [iterations]
+ *
+ *    This command lists every process once a second, for the number of
+ *    iterations provided (or 5 by default), with the share of processor
+ *    time each one used in that second.  For example,
+ *
+ *    top 10
+ *
+ *    would show which processes are using the processor for 10 seconds.
+ *
+ * f. loglevel <level>
+ *
+ *    This command sets the kernel log level, from 0 (errors only) to 3
+ *    (everything, including the single-character debug output on each
+ *    context switch), which cannot exceed that fixed at compile-time.
+ *    For example,
+ *
+ *    loglevel 2
+ *
+ *    would turn off the debug output.
+ *
+ * g. kmem
+ *
+ *    This command lists how many pages the kernel has allocated (and the
+ *    largest block still free), then how many objects each slab cache
+ *    (e.g., of PCBs or pipes) has allocated, out of how many it holds.
  */
 
 void main_console() {
-  char* p, x[ 1024 ];
+  char* p, x[ 1024 ]; FILE f = { CONSOLE_FILENO, _IOFBF, 0 }; pid_t r; int s;
 
   while( 1 ) {
+    while( ( r = waitpid( -1, &s, WNOHANG ) ) > 0 ) {
+      fprintf( &f, "process %d exited with status %d\n", r, s ); fflush( &f );
+    }
+
     puts( "shell$ ", 7 ); gets( x, 1024 ); p = strtok( x, " " );
 
     if     ( 0 == strcmp( p, "execute"   ) ) {
-      pid_t pid = fork();
+      char* q = strtok( NULL, " " );
+      char* n = strtok( NULL, " " );
 
-      if( 0 == pid ) {
-        exec( load( strtok( NULL, " " ) ) );
+      if( spawn( load( q ), 0, ( n != NULL ) ? ( atoi( n ) * 1024 ) : 0 ) < 0 ) {
+        puts( "execute failed\n", 15 );
       }
     }
     else if( 0 == strcmp( p, "terminate" ) ) {
@@ -103,6 +278,26 @@ void main_console() {
 
       kill( pid, s );
     }
+    else if( 0 == strcmp( p, "nice"      ) ) {
+      pid_t pid = atoi( strtok( NULL, " " ) );
+      int   x   = atoi( strtok( NULL, " " ) );
+
+      nice( pid, x );
+    }
+    else if( 0 == strcmp( p, "ps"        ) ) {
+      ps_show( &f );
+    }
+    else if( 0 == strcmp( p, "top"       ) ) {
+      char* k = strtok( NULL, " " );
+
+      top_show( &f, ( k != NULL ) ? atoi( k ) : 5 );
+    }
+    else if( 0 == strcmp( p, "loglevel"  ) ) {
+      loglevel( atoi( strtok( NULL, " " ) ) );
+    }
+    else if( 0 == strcmp( p, "kmem"      ) ) {
+      kmem_show( &f );
+    }
     else {
       puts( "unknown command\n", 16 );
     }
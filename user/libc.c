@@ -7,6 +7,8 @@
 
 #include "libc.h"
 
+#include <string.h>
+
 int  atoi( char* x        ) {
   char* p = x; bool s = false; int r = 0;
 
@@ -62,16 +64,29 @@ void yield() {
 }
 
 int write( int fd, const void* x, size_t n ) {
-  int r;
+  int r = 0;
 
-  asm volatile( "mov r0, %2 \n" // assign r0 = fd
-                "mov r1, %3 \n" // assign r1 =  x
-                "mov r2, %4 \n" // assign r2 =  n
-                "svc %1     \n" // make system call SYS_WRITE
-                "mov %0, r0 \n" // assign r  = r0
-              : "=r" (r)
-              : "I" (SYS_WRITE), "r" (fd), "r" (x), "r" (n)
-              : "r0", "r1", "r2" );
+  // the kernel may write fewer than n bytes (i.e., as many as it can buffer), so repeat until done
+  while( r < n ) {
+    int t;
+
+    tls()->writes++;
+
+    asm volatile( "mov r0, %2 \n" // assign r0 = fd
+                  "mov r1, %3 \n" // assign r1 =  x
+                  "mov r2, %4 \n" // assign r2 =  n
+                  "svc %1     \n" // make system call SYS_WRITE
+                  "mov %0, r0 \n" // assign t  = r0
+                : "=r" (t)
+                : "I" (SYS_WRITE), "r" (fd), "r" ( ( const uint8_t* )( x ) + r ), "r" (n - r)
+                : "r0", "r1", "r2" );
+
+    if( t <= 0 ) {
+      return ( r > 0 ) ? r : t;
+    }
+
+    r += t;
+  }
 
   return r;
 }
@@ -91,6 +106,22 @@ int  read( int fd,       void* x, size_t n ) {
   return r;
 }
 
+void usleep( uint32_t x ) {
+  asm volatile( "mov r0, %1 \n" // assign r0 =  x
+                "svc %0     \n" // make system call SYS_SLEEP
+              :
+              : "I" (SYS_SLEEP), "r" (x)
+              : "r0" );
+
+  return;
+}
+
+void  sleep( uint32_t x ) {
+  usleep( x * 1000 );
+
+  return;
+}
+
 int  fork() {
   int r;
 
@@ -104,6 +135,9 @@ int  fork() {
 }
 
 void exit( int x ) {
+  fflush( stdout );
+  fflush( stderr );
+
   asm volatile( "mov r0, %1 \n" // assign r0 =  x
                 "svc %0     \n" // make system call SYS_EXIT
               :
@@ -113,16 +147,331 @@ void exit( int x ) {
   return;
 }
 
+pid_t waitpid( pid_t pid, int* x, int flags ) {
+  pid_t r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 = pid
+                "mov r1, %3 \n" // assign r1 = x
+                "mov r2, %4 \n" // assign r2 = flags
+                "svc %1     \n" // make system call SYS_WAITPID
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_WAITPID), "r" (pid), "r" (x), "r" (flags)
+              : "r0", "r1", "r2", "memory" );
+
+  return r;
+}
+
 void exec( const void* x ) {
+  exec_stack( x, 0 );
+
+  return;
+}
+
+void exec_stack( const void* x, size_t n ) {
   asm volatile( "mov r0, %1 \n" // assign r0 = x
+                "mov r1, %2 \n" // assign r1 = n
                 "svc %0     \n" // make system call SYS_EXEC
               :
-              : "I" (SYS_EXEC), "r" (x)
+              : "I" (SYS_EXEC), "r" (x), "r" (n)
+              : "r0", "r1" );
+
+  return;
+}
+
+pid_t spawn( const void* x, int y, size_t n ) {
+  pid_t r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 = x
+                "mov r1, %3 \n" // assign r1 = y
+                "mov r2, %4 \n" // assign r2 = n
+                "svc %1     \n" // make system call SYS_SPAWN
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_SPAWN), "r" (x), "r" (y), "r" (n)
+              : "r0", "r1", "r2" );
+
+  return r;
+}
+
+/* A new thread starts in thread_start, so that returning from fn is the
+ * same as calling thread_exit.  Its thread-local area starts off zeroed,
+ * bar the arena, which has to be shared since it carves blocks from the
+ * one heap: the creator passes it on (having made sure there is one, via
+ * malloc) along with fn and x.
+ */
+
+typedef struct {
+  void* (*fn)( void* x );
+  void*   x;
+  void*   arena;
+} thread_t;
+
+void thread_start( thread_t* t ) {
+  void* (*fn)( void* x ) = t->fn; void* x = t->x;
+
+  tls()->arena = t->arena; free( t );
+
+  thread_exit( fn( x ) );
+}
+
+pid_t thread_create( void* (*fn)( void* x ), void* x, size_t n ) {
+  thread_t* t = malloc( sizeof( thread_t ) ); pid_t r;
+
+  if( t == NULL ) {
+    return -1;
+  }
+
+  t->fn    = fn;
+  t->x     = x;
+  t->arena = tls()->arena;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 = thread_start
+                "mov r1, %3 \n" // assign r1 = t
+                "mov r2, %4 \n" // assign r2 = n
+                "svc %1     \n" // make system call SYS_THREAD
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_THREAD), "r" (&thread_start), "r" (t), "r" (n)
+              : "r0", "r1", "r2" );
+
+  if( r < 0 ) {
+    free( t );
+  }
+
+  return r;
+}
+
+void  thread_exit( void* x ) {
+  fflush( stdout );
+  fflush( stderr );
+
+  asm volatile( "mov r0, %1 \n" // assign r0 =  x
+                "svc %0     \n" // make system call SYS_THREAD_EXIT
+              :
+              : "I" (SYS_THREAD_EXIT), "r" (x)
               : "r0" );
 
   return;
 }
 
+int   thread_join( pid_t t, void** x ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  t
+                "mov r1, %3 \n" // assign r1 =  x
+                "svc %1     \n" // make system call SYS_THREAD_JOIN
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_THREAD_JOIN), "r" (t), "r" (x)
+              : "r0", "r1" );
+
+  return r;
+}
+
+/* Each atomic operation retries until the STREX succeeds, i.e., nothing
+ * else wrote to the word (and there was no context switch, since the
+ * kernel clears the exclusive monitor on each one) after the LDREX.
+ */
+
+uint32_t atomic_cas( volatile uint32_t* x, uint32_t y, uint32_t z ) {
+  uint32_t r, t;
+
+  asm volatile( "dmb                  \n"
+                "1: ldrex %0, [%2]    \n" // r = *x, and mark x for exclusive access
+                "   cmp   %0, %3      \n"
+                "   bne   2f          \n" // give up iff. r != y
+                "   strex %1, %4, [%2]\n" // *x = z iff. still exclusive, with t = 0 iff. so
+                "   cmp   %1, #0      \n"
+                "   bne   1b          \n"
+                "2: dmb               \n"
+              : "=&r" (r), "=&r" (t)
+              : "r" (x), "r" (y), "r" (z)
+              : "cc", "memory" );
+
+  return r;
+}
+
+uint32_t atomic_xchg( volatile uint32_t* x, uint32_t y ) {
+  uint32_t r, t;
+
+  asm volatile( "dmb                  \n"
+                "1: ldrex %0, [%2]    \n" // r = *x, and mark x for exclusive access
+                "   strex %1, %3, [%2]\n" // *x = y iff. still exclusive, with t = 0 iff. so
+                "   cmp   %1, #0      \n"
+                "   bne   1b          \n"
+                "   dmb               \n"
+              : "=&r" (r), "=&r" (t)
+              : "r" (x), "r" (y)
+              : "cc", "memory" );
+
+  return r;
+}
+
+uint32_t atomic_add( volatile uint32_t* x, int32_t y ) {
+  uint32_t r, t;
+
+  asm volatile( "dmb                  \n"
+                "1: ldrex %0, [%2]    \n" // r = *x, and mark x for exclusive access
+                "   add   %0, %0, %3  \n" // r = r + y
+                "   strex %1, %0, [%2]\n" // *x = r iff. still exclusive, with t = 0 iff. so
+                "   cmp   %1, #0      \n"
+                "   bne   1b          \n"
+                "   dmb               \n"
+              : "=&r" (r), "=&r" (t)
+              : "r" (x), "r" (y)
+              : "cc", "memory" );
+
+  return r;
+}
+
+int  futex_wait( volatile uint32_t* x, uint32_t y ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "mov r1, %3 \n" // assign r1 =  y
+                "svc %1     \n" // make system call SYS_FUTEX_WAIT
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_FUTEX_WAIT), "r" (x), "r" (y)
+              : "r0", "r1", "memory" );
+
+  return r;
+}
+
+int  futex_wake( volatile uint32_t* x, int n ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "mov r1, %3 \n" // assign r1 =  n
+                "svc %1     \n" // make system call SYS_FUTEX_WAKE
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_FUTEX_WAKE), "r" (x), "r" (n)
+              : "r0", "r1", "memory" );
+
+  return r;
+}
+
+/* A mutex is Drepper's third one: locking is a CAS from 0 to 1 unless it
+ * is contended, in which case the state is set to 2 before waiting, so the
+ * thread that unlocks it knows it has to wake one of them.
+ */
+
+void mutex_init( mutex_t* m ) {
+  m->state = 0;
+}
+
+void mutex_lock( mutex_t* m ) {
+  uint32_t c = atomic_cas( &m->state, 0, 1 );
+
+  if( c == 0 ) {
+    return;
+  }
+  if( c != 2 ) {
+    c = atomic_xchg( &m->state, 2 );
+  }
+
+  while( c != 0 ) {
+    futex_wait( &m->state, 2 ); c = atomic_xchg( &m->state, 2 );
+  }
+}
+
+bool mutex_trylock( mutex_t* m ) {
+  return atomic_cas( &m->state, 0, 1 ) == 0;
+}
+
+void mutex_unlock( mutex_t* m ) {
+  if( atomic_xchg( &m->state, 0 ) == 2 ) {
+    futex_wake( &m->state, 1 );
+  }
+}
+
+/* A condition variable waits on a sequence number, so a signal that
+ * happens between unlocking the mutex and waiting is not lost: the number
+ * will have changed, so futex_wait returns straight away.  Signalling
+ * only makes a system call if some thread is waiting.
+ */
+
+void cond_init( cond_t* c ) {
+  c->seq     = 0;
+  c->waiters = 0;
+}
+
+void cond_wait( cond_t* c, mutex_t* m ) {
+  uint32_t s = c->seq;
+
+  atomic_add( &c->waiters, 1 );
+  mutex_unlock( m );
+
+  futex_wait( &c->seq, s );
+
+  atomic_add( &c->waiters, -1 );
+
+  // some other thread may have been woken too, so lock as if contended
+  while( atomic_xchg( &m->state, 2 ) != 0 ) {
+    futex_wait( &m->state, 2 );
+  }
+}
+
+void cond_signal( cond_t* c ) {
+  atomic_add( &c->seq, 1 );
+
+  if( c->waiters != 0 ) {
+    futex_wake( &c->seq, 1 );
+  }
+}
+
+void cond_broadcast( cond_t* c ) {
+  atomic_add( &c->seq, 1 );
+
+  if( c->waiters != 0 ) {
+    futex_wake( &c->seq, INT32_MAX );
+  }
+}
+
+/* A semaphore waits on its value being 0, so, as above, a post between
+ * seeing 0 and waiting is not lost; posting only makes a system call if
+ * some thread is waiting.
+ */
+
+void sem_init( sem_t* s, uint32_t n ) {
+  s->value   = n;
+  s->waiters = 0;
+}
+
+bool sem_trywait( sem_t* s ) {
+  uint32_t v = s->value;
+
+  while( v != 0 ) {
+    uint32_t w = atomic_cas( &s->value, v, v - 1 );
+
+    if( w == v ) {
+      return true;
+    }
+
+    v = w;
+  }
+
+  return false;
+}
+
+void sem_wait( sem_t* s ) {
+  while( !sem_trywait( s ) ) {
+    atomic_add( &s->waiters, 1 );
+    futex_wait( &s->value, 0 );
+    atomic_add( &s->waiters, -1 );
+  }
+}
+
+void sem_post( sem_t* s ) {
+  atomic_add( &s->value, 1 );
+
+  if( s->waiters != 0 ) {
+    futex_wake( &s->value, 1 );
+  }
+}
+
 int  kill( int pid, int x ) {
   int r;
 
@@ -137,15 +486,18 @@ int  kill( int pid, int x ) {
   return r;
 }
 
-void nice( int pid, int x ) {
-  asm volatile( "mov r0, %1 \n" // assign r0 =  pid
-                "mov r1, %2 \n" // assign r1 =    x
-                "svc %0     \n" // make system call SYS_NICE
-              :
+int  nice( int pid, int x ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  pid
+                "mov r1, %3 \n" // assign r1 =    x
+                "svc %1     \n" // make system call SYS_NICE
+                "mov %0, r0 \n" // assign r0 =    r
+              : "=r" (r)
               : "I" (SYS_NICE), "r" (pid), "r" (x)
               : "r0", "r1" );
 
-  return;
+  return r;
 }
 
 int  pipe() {
@@ -172,3 +524,693 @@ int  open( int x ) {
 
   return r;
 }
+
+int  close( int x ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  fd
+                "svc %1     \n" // make system call SYS_CLOSE
+                "mov %0, r0 \n" // assign r0 =    r
+              : "=r" (r)
+              : "I" (SYS_CLOSE), "r" (x)
+              : "r0" );
+
+  return r;
+}
+
+int  sched_rt( uint32_t period, uint32_t budget, uint32_t deadline ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =   period
+                "mov r1, %3 \n" // assign r1 =   budget
+                "mov r2, %4 \n" // assign r2 = deadline
+                "svc %1     \n" // make system call SYS_RT
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_RT), "r" (period), "r" (budget), "r" (deadline)
+              : "r0", "r1", "r2" );
+
+  return r;
+}
+
+int  sched_rt_misses( int pid ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  pid
+                "svc %1     \n" // make system call SYS_RT_MISSES
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_RT_MISSES), "r" (pid)
+              : "r0" );
+
+  return r;
+}
+
+int  ps( procinfo_t* x, int n ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "mov r1, %3 \n" // assign r1 =  n
+                "svc %1     \n" // make system call SYS_PS
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_PS), "r" (x), "r" (n)
+              : "r0", "r1" );
+
+  return r;
+}
+
+pid_t getpid() {
+  pid_t r;
+
+  asm volatile( "svc %1     \n" // make system call SYS_GETPID
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_GETPID)
+              : "r0" );
+
+  return r;
+}
+
+int  loglevel( int x ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "svc %1     \n" // make system call SYS_LOGLEVEL
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_LOGLEVEL), "r" (x)
+              : "r0" );
+
+  return r;
+}
+
+int  kmem( kmeminfo_t* x, int n ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "mov r1, %3 \n" // assign r1 =  n
+                "svc %1     \n" // make system call SYS_KMEM
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_KMEM), "r" (x), "r" (n)
+              : "r0", "r1" );
+
+  return r;
+}
+
+void* sbrk( intptr_t n ) {
+  void* r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  n
+                "svc %1     \n" // make system call SYS_SBRK
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_SBRK), "r" (n)
+              : "r0" );
+
+  return r;
+}
+
+void* mmap( size_t n ) {
+  void* r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  n
+                "svc %1     \n" // make system call SYS_MMAP
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_MMAP), "r" (n)
+              : "r0" );
+
+  return r;
+}
+
+int  munmap( void* x, size_t n ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "mov r1, %3 \n" // assign r1 =  n
+                "svc %1     \n" // make system call SYS_MUNMAP
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_MUNMAP), "r" (x), "r" (n)
+              : "r0", "r1" );
+
+  return r;
+}
+
+uint32_t cycles() {
+  uint32_t r;
+
+  asm volatile( "mrc p15, 0, %0, c9, c13, 0 \n" // assign r  = PMCCNTR
+              : "=r" (r) );
+
+  return r;
+}
+
+int  irq_latency( uint32_t* x, int n ) {
+  int r;
+
+  asm volatile( "mov r0, %2 \n" // assign r0 =  x
+                "mov r1, %3 \n" // assign r1 =  n
+                "svc %1     \n" // make system call SYS_IRQ_LATENCY
+                "mov %0, r0 \n" // assign r  = r0
+              : "=r" (r)
+              : "I" (SYS_IRQ_LATENCY), "r" (x), "r" (n)
+              : "r0", "r1" );
+
+  return r;
+}
+
+tls_t* tls() {
+  tls_t* r;
+
+  asm volatile( "mrc p15, 0, %0, c13, c0, 3 \n" // assign r  = TPIDRURO
+              : "=r" (r) );
+
+  if( !r->init ) {
+    r->out.fd   = STDOUT_FILENO;
+    r->out.mode = isatty( STDOUT_FILENO ) ? _IOLBF : _IOFBF;
+    r->out.n    = 0;
+
+    r->err.fd   = STDERR_FILENO;
+    r->err.mode = _IONBF;
+    r->err.n    = 0;
+
+    r->init     = true;
+  }
+
+  return r;
+}
+
+int    isatty( int fd ) {
+  return ( fd >= STDIN_FILENO ) && ( fd <= CONSOLE_FILENO );
+}
+
+int    setvbuf( FILE* f, char* buf, int x, size_t n ) {
+  if( ( x != _IOFBF && x != _IOLBF && x != _IONBF ) || fflush( f ) == EOF ) {
+    return EOF;
+  }
+
+  f->mode = x; // the buffer is always f->buf, so buf and n are ignored (which the standard allows)
+
+  return 0;
+}
+
+int    fflush( FILE* f ) {
+  int r = 0;
+
+  if( f->n > 0 ) {
+    r = write( f->fd, f->buf, f->n ); f->n = 0;
+  }
+
+  return ( r < 0 ) ? EOF : 0;
+}
+
+int    fputc( int x, FILE* f ) {
+  if( f->mode == _IONBF ) {
+    char c = x;
+
+    return ( write( f->fd, &c, 1 ) == 1 ) ? ( uint8_t )( x ) : EOF;
+  }
+
+  f->buf[ f->n++ ] = x;
+
+  if( ( f->n == BUFSIZ ) || ( f->mode == _IOLBF && x == '\x0A' ) ) {
+    if( fflush( f ) == EOF ) {
+      return EOF;
+    }
+  }
+
+  return ( uint8_t )( x );
+}
+
+size_t fwrite( const void* x, size_t size, size_t n, FILE* f ) {
+  const char* p = x; size_t m = size * n;
+
+  if( m == 0 ) {
+    return 0;
+  }
+
+  if( f->mode == _IONBF ) {
+    int r = write( f->fd, p, m );
+
+    return ( r < 0 ) ? 0 : ( r / size );
+  }
+
+  for( size_t i = 0; i < m; i++ ) {
+    if( fputc( p[ i ], f ) == EOF ) {
+      return i / size;
+    }
+  }
+
+  return n;
+}
+
+int    fputs( const char* x, FILE* f ) {
+  size_t n = 0;
+
+  while( x[ n ] != '\x00' ) {
+    n++;
+  }
+
+  return ( fwrite( x, 1, n, f ) == n ) ? 0 : EOF;
+}
+
+/* Output an unsigned integer x in base b, preceded by a minus sign iff. m,
+ * right-aligned in a field of at least w characters (padded with c, which
+ * goes before the sign if it is a space, and after it if it is a zero);
+ * return the number of bytes output.
+ */
+
+int    fputu( FILE* f, uint32_t x, bool m, int b, int w, char c, const char* digits ) {
+  char t[ 10 ]; int n = 0, r = 0;
+
+  do {
+    t[ n++ ] = digits[ x % b ]; x /= b;
+  } while( x );
+
+  w -= m ? 1 : 0;
+
+  for( ; c == ' ' && w > n; w--, r++ ) {
+    fputc( c, f );
+  }
+  if( m ) {
+    fputc( '-', f ); r++;
+  }
+  for( ; w > n; w--, r++ ) {
+    fputc( c, f );
+  }
+  for( ; n > 0; n--, r++ ) {
+    fputc( t[ n - 1 ], f );
+  }
+
+  return r;
+}
+
+int   vfprintf( FILE* f, const char* x, va_list a ) {
+  const char* lower = "0123456789abcdef";
+  const char* upper = "0123456789ABCDEF";
+
+  int r = 0, m = f->mode;
+
+  // an unbuffered stream is temporarily fully buffered, so the output is written all at once
+  if( m == _IONBF ) {
+    f->mode = _IOFBF;
+  }
+
+  for( ; *x != '\x00'; x++ ) {
+    if( *x != '%' ) {
+      fputc( *x, f ); r++; continue;
+    }
+
+    char c = ' '; int w = 0;
+
+    if( *++x == '0' ) {
+      c = '0'; x++;
+    }
+    while( *x >= '0' && *x <= '9' ) {
+      w = ( w * 10 ) + ( *x++ - '0' );
+    }
+    if( *x == 'l' ) {
+      x++;
+    }
+
+    switch( *x ) {
+      case 'c'  : {
+        fputc( va_arg( a, int ), f ); r++;
+        break;
+      }
+      case 's'  : {
+        const char* p = va_arg( a, const char* );
+
+        for( ; *p != '\x00'; p++, r++ ) {
+          fputc( *p, f );
+        }
+
+        break;
+      }
+      case 'd'  :
+      case 'i'  : {
+        int t = va_arg( a, int );
+
+        r += fputu( f, ( t < 0 ) ? -( uint32_t )( t ) : ( uint32_t )( t ), ( t < 0 ), 10, w, c, lower );
+        break;
+      }
+      case 'u'  : {
+        r += fputu( f, va_arg( a, uint32_t ), false, 10, w, c, lower );
+        break;
+      }
+      case 'x'  : {
+        r += fputu( f, va_arg( a, uint32_t ), false, 16, w, c, lower );
+        break;
+      }
+      case 'X'  : {
+        r += fputu( f, va_arg( a, uint32_t ), false, 16, w, c, upper );
+        break;
+      }
+      case 'p'  : {
+        fputs( "0x", f ); r += 2;
+        r += fputu( f, ( uint32_t )( va_arg( a, void* ) ), false, 16, 8, '0', lower );
+        break;
+      }
+      case '\x00' : {
+        x--; // a trailing %, so stop
+        break;
+      }
+      default   : {
+        fputc( *x, f ); r++;
+        break;
+      }
+    }
+  }
+
+  if( m == _IONBF ) {
+    f->mode = m; fflush( f );
+  }
+
+  return r;
+}
+
+int    fprintf( FILE* f, const char* x, ... ) {
+  va_list a; va_start( a, x );
+  int r = vfprintf( f, x, a );
+  va_end( a );
+
+  return r;
+}
+
+int     printf(          const char* x, ... ) {
+  va_list a; va_start( a, x );
+  int r = vfprintf( stdout, x, a );
+  va_end( a );
+
+  return r;
+}
+
+/* Every block starts with an 8-byte header holding the size of the block
+ * before it (so the two can be coalesced) and its own size, including the
+ * header; sizes are multiples of 8, so the low bits hold flags.  A free
+ * large block also holds the links for its bin, just after the header.
+ * The arena ends with a sentinel, i.e., a 0-size block marked in use, at
+ * the break: growing the arena turns the old sentinel into the header of
+ * a new free block, and puts a new one at the new break.
+ */
+
+#define BLOCK_INUSE    ( 0x1 )
+#define BLOCK_SMALL    ( 0x2 )
+#define BLOCK_HUGE     ( 0x4 )
+#define BLOCK_FLAGS    ( 0x7 )
+
+#define BLOCK_HEADER   ( 8 )
+#define BLOCK_MIN      ( 32 ) // the smallest large block worth splitting off
+
+#define ARENA_BINS     ( 32 )
+#define ARENA_GROW     ( 0x00004000 )
+
+typedef struct block_s {
+  uint32_t prev;              // size of the block before, or 0 if this is the first
+  uint32_t size;              // size of this block | flags
+  struct block_s* fd;         // bin links, iff. a free large block
+  struct block_s* bk;
+} block_t;
+
+typedef struct {
+  block_t* bin[ ARENA_BINS ]; // free large blocks, with bin i holding those of 2^i ... 2^( i + 1 ) - 1 bytes
+  uint32_t bitmap;            // bit i set iff. bin i is non-empty
+  block_t* end;               // the sentinel
+  mutex_t  lock;              // held while using any of the above
+} arena_t;
+
+#define ARENA_SIZE     ( ( sizeof( arena_t ) + 7 ) & ~7 ) // so the blocks that follow are aligned
+
+#define BLOCK_SIZE( b ) ( ( b )->size & ~BLOCK_FLAGS )
+#define BLOCK_NEXT( b ) ( ( block_t* )( ( uint8_t* )( b ) + BLOCK_SIZE( b ) ) )
+#define BLOCK_PREV( b ) ( ( block_t* )( ( uint8_t* )( b ) - ( b )->prev ) )
+
+void arena_insert( arena_t* a, block_t* b ) {
+  int i = 31 - __builtin_clz( b->size );
+
+  b->bk = NULL;
+  b->fd = a->bin[ i ];
+
+  if( b->fd != NULL ) {
+    b->fd->bk = b;
+  }
+
+  a->bin[ i ] = b;
+  a->bitmap  |= ( 1 << i );
+}
+
+void arena_remove( arena_t* a, block_t* b ) {
+  int i = 31 - __builtin_clz( b->size );
+
+  if( b->bk != NULL ) {
+    b->bk->fd = b->fd;
+  }
+  else {
+    a->bin[ i ] = b->fd;
+  }
+  if( b->fd != NULL ) {
+    b->fd->bk = b->bk;
+  }
+
+  if( a->bin[ i ] == NULL ) {
+    a->bitmap &= ~( 1 << i );
+  }
+}
+
+// free large block b, coalescing it with either neighbour that is free too
+void arena_release( arena_t* a, block_t* b ) {
+  block_t* n = BLOCK_NEXT( b );
+
+  b->size &= ~BLOCK_FLAGS;
+
+  if( !( n->size & BLOCK_INUSE ) ) {
+    arena_remove( a, n ); b->size += n->size;
+  }
+  if( b->prev != 0 && !( BLOCK_PREV( b )->size & BLOCK_INUSE ) ) {
+    block_t* p = BLOCK_PREV( b );
+
+    arena_remove( a, p ); p->size += b->size; b = p;
+  }
+
+  BLOCK_NEXT( b )->prev = b->size;
+
+  arena_insert( a, b );
+}
+
+// grow the arena by (at least) n bytes
+bool arena_grow( arena_t* a, uint32_t n ) {
+  n = ( n < ARENA_GROW ) ? ARENA_GROW : ( ( n + 0xFFF ) & ~0xFFF );
+
+  if( sbrk( n ) == ( void* )( -1 ) ) {
+    return false;
+  }
+
+  block_t* b = a->end;
+
+  b->size = n | BLOCK_INUSE;
+
+  a->end = BLOCK_NEXT( b );
+  a->end->prev = n;
+  a->end->size = 0 | BLOCK_INUSE;
+
+  arena_release( a, b );
+
+  return true;
+}
+
+arena_t* arena_init() {
+  arena_t* a = sbrk( ARENA_SIZE + BLOCK_HEADER );
+
+  if( a == ( void* )( -1 ) ) {
+    return NULL;
+  }
+
+  memset( a, 0, sizeof( arena_t ) );
+
+  a->end = ( block_t* )( ( uint8_t* )( a ) + ARENA_SIZE );
+  a->end->prev = 0;
+  a->end->size = 0 | BLOCK_INUSE;
+
+  return a;
+}
+
+// allocate a large block of n bytes (header included, and a multiple of 8)
+block_t* arena_alloc( arena_t* a, uint32_t n ) {
+  int      i = 31 - __builtin_clz( n );
+  block_t* b = a->bin[ i ];
+
+  while( b != NULL && b->size < n ) { // first fit in the bin n is in ...
+    b = b->fd;
+  }
+
+  if( b == NULL ) { // ... otherwise anything in a larger bin fits
+    uint32_t m = a->bitmap & ~( ( 2 << i ) - 1 );
+
+    if( m == 0 ) {
+      if( !arena_grow( a, n + BLOCK_HEADER ) ) {
+        return NULL;
+      }
+
+      return arena_alloc( a, n );
+    }
+
+    b = a->bin[ __builtin_ctz( m ) ];
+  }
+
+  arena_remove( a, b );
+
+  if( ( b->size - n ) >= BLOCK_MIN ) {
+    block_t* r = ( block_t* )( ( uint8_t* )( b ) + n );
+
+    r->prev = n;
+    r->size = b->size - n;
+    b->size = n;
+
+    BLOCK_NEXT( r )->prev = r->size;
+
+    arena_insert( a, r );
+  }
+
+  b->size |= BLOCK_INUSE;
+
+  return b;
+}
+
+// refill the free list for small size class c, by carving up a large block
+bool malloc_refill( tls_t* t, int c ) {
+  uint32_t n = 16 << c;
+  arena_t* a = t->arena;
+
+  mutex_lock( &a->lock );
+  block_t* b = arena_alloc( a, MALLOC_CHUNK + BLOCK_HEADER );
+  mutex_unlock( &a->lock );
+
+  if( b == NULL ) {
+    return false;
+  }
+
+  for( uint8_t* x = ( uint8_t* )( b ) + BLOCK_HEADER; ( x + n ) <= ( uint8_t* )( BLOCK_NEXT( b ) ); x += n ) {
+    block_t* y = ( block_t* )( x );
+
+    y->prev = 0;
+    y->size = n | BLOCK_INUSE | BLOCK_SMALL;
+
+    *( void** )( x + BLOCK_HEADER ) = t->bins[ c ];
+    t->bins[ c ] = x + BLOCK_HEADER;
+  }
+
+  return true;
+}
+
+void* malloc( size_t n ) {
+  tls_t* t = tls();
+
+  if( n > ( MALLOC_HUGE - BLOCK_HEADER ) ) {
+    uint32_t m = ( n + BLOCK_HEADER + 0xFFF ) & ~0xFFF;
+    block_t* b = ( m > n ) ? mmap( m ) : MAP_FAILED;
+
+    if( b == MAP_FAILED ) {
+      return NULL;
+    }
+
+    b->size = m | BLOCK_INUSE | BLOCK_HUGE;
+
+    return ( uint8_t* )( b ) + BLOCK_HEADER;
+  }
+
+  uint32_t m = ( n + BLOCK_HEADER + 7 ) & ~7;
+
+  if( t->arena == NULL && ( t->arena = arena_init() ) == NULL ) {
+    return NULL;
+  }
+
+  if( m <= MALLOC_SMALL ) {
+    int c = ( m <= 16 ) ? 0 : ( 28 - __builtin_clz( m - 1 ) ); // i.e., log2( m ) - 4, rounded up
+
+    if( t->bins[ c ] == NULL && !malloc_refill( t, c ) ) {
+      return NULL;
+    }
+
+    void* x = t->bins[ c ];
+
+    t->bins[ c ] = *( void** )( x );
+
+    return x;
+  }
+
+  arena_t* a = t->arena;
+
+  mutex_lock( &a->lock );
+  block_t* b = arena_alloc( a, m );
+  mutex_unlock( &a->lock );
+
+  return ( b != NULL ) ? ( ( uint8_t* )( b ) + BLOCK_HEADER ) : NULL;
+}
+
+void  free( void* x ) {
+  if( x == NULL ) {
+    return;
+  }
+
+  tls_t*   t = tls();
+  block_t* b = ( block_t* )( ( uint8_t* )( x ) - BLOCK_HEADER );
+
+  if     ( b->size & BLOCK_SMALL ) {
+    int c = 27 - __builtin_clz( BLOCK_SIZE( b ) );
+
+    *( void** )( x ) = t->bins[ c ];
+    t->bins[ c ] = x;
+  }
+  else if( b->size & BLOCK_HUGE  ) {
+    munmap( b, BLOCK_SIZE( b ) );
+  }
+  else {
+    arena_t* a = t->arena;
+
+    mutex_lock( &a->lock );
+    arena_release( a, b );
+    mutex_unlock( &a->lock );
+  }
+}
+
+void* calloc( size_t n, size_t size ) {
+  uint64_t m = ( uint64_t )( n ) * size;
+
+  if( m > 0xFFFFFFFF ) {
+    return NULL;
+  }
+
+  void* x = malloc( m );
+
+  if( x != NULL ) {
+    memset( x, 0, m );
+  }
+
+  return x;
+}
+
+void* realloc( void* x, size_t n ) {
+  if( x == NULL ) {
+    return malloc( n );
+  }
+  if( n == 0 ) {
+    free( x ); return NULL;
+  }
+
+  uint32_t m = BLOCK_SIZE( ( block_t* )( ( uint8_t* )( x ) - BLOCK_HEADER ) ) - BLOCK_HEADER;
+
+  if( n <= m ) {
+    return x;
+  }
+
+  void* y = malloc( n );
+
+  if( y != NULL ) {
+    memcpy( y, x, m ); free( x );
+  }
+
+  return y;
+}
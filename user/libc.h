@@ -8,10 +8,13 @@
 #ifndef __LIBC_H
 #define __LIBC_H
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include "tls.h"
+
 // Define a type that that captures a Process IDentifier (PID).
 
 typedef int pid_t;
@@ -42,17 +45,44 @@ typedef int pid_t;
 //NEW ONES
 #define SYS_PIPE      ( 0x08 )
 #define SYS_OPEN      ( 0x09 )
+#define SYS_RT        ( 0x0A )
+#define SYS_RT_MISSES ( 0x0B )
+#define SYS_SLEEP     ( 0x0C )
+#define SYS_PS        ( 0x0D )
+#define SYS_GETPID    ( 0x0E )
+#define SYS_IRQ_LATENCY ( 0x0F )
+#define SYS_LOGLEVEL  ( 0x10 )
+#define SYS_KMEM      ( 0x11 )
+#define SYS_SBRK      ( 0x12 )
+#define SYS_MMAP      ( 0x13 )
+#define SYS_MUNMAP    ( 0x14 )
+#define SYS_SPAWN     ( 0x15 )
+#define SYS_THREAD    ( 0x16 )
+#define SYS_THREAD_EXIT ( 0x17 )
+#define SYS_THREAD_JOIN ( 0x18 )
+#define SYS_FUTEX_WAIT ( 0x19 )
+#define SYS_FUTEX_WAKE ( 0x1A )
+#define SYS_WAITPID   ( 0x1B )
+#define SYS_CLOSE     ( 0x1C )
 
 #define SIG_TERM      ( 0x00 )
 #define SIG_QUIT      ( 0x01 )
 
 #define EXIT_SUCCESS  ( 0 )
 #define EXIT_FAILURE  ( 1 )
+#define EXIT_KILLED   ( -1 ) // the exit status of a process that was killed, or that faulted
+
+#define WNOHANG       ( 1 )  // a waitpid flag: return 0 rather than wait, if no child has exited yet
 
 #define  STDIN_FILENO ( 0 )
 #define STDOUT_FILENO ( 1 )
 #define STDERR_FILENO ( 2 )
 
+#define CONSOLE_FILENO ( 3 ) // the console's own terminal, i.e., UART1
+
+
+#define CPU_HZ        ( 1000000000 ) // cycle counter frequency (per QEMU)
+
 // convert ASCII string x into integer r
 extern int  atoi( char* x        );
 // convert integer x into ASCII string r
@@ -66,21 +96,305 @@ extern int write( int fd, const void* x, size_t n );
 // read  n bytes into x from the file descriptor fd; return bytes read
 extern int  read( int fd,       void* x, size_t n );
 
+// wait (without using the processor) for x microseconds
+extern void usleep( uint32_t x );
+// wait (without using the processor) for x milliseconds
+extern void  sleep( uint32_t x );
+
 // perform fork, returning 0 iff. child or > 0 iff. parent process
 extern int  fork();
 // perform exit, i.e., terminate process with status x
 extern void exit(       int   x );
-// perform exec, i.e., start executing program at address x
+// wait for child process pid (or, if pid = -1, any child) to exit, then store its exit status in *x (unless x = NULL); return its PID, 0 if flags includes WNOHANG and it has yet to exit, or -1 if there is no such child
+extern pid_t waitpid( pid_t pid, int* x, int flags );
+// perform exec, i.e., start executing program at address x (returning only if that fails)
 extern void exec( const void* x );
+// perform exec, as above, but with a stack of n bytes (rather than the default 4KiB) for the program
+extern void exec_stack( const void* x, size_t n );
+// create a process executing program at address x, with nice value y and a stack of n bytes (or 4KiB if n = 0); return its PID, or -1 if impossible
+extern pid_t spawn( const void* x, int y, size_t n );
+
+/* A process may create further threads, which the kernel schedules
+ * individually but which share everything bar their registers and stack
+ * (and so thread-local area): memory, including the heap, pipes and so on.
+ * A thread is identified by a PID of its own; exit (or being killed)
+ * terminates every thread in the process, whereas thread_exit terminates
+ * just the calling one, unless it is the last.  The first thread lasts as
+ * long as the process does, so it alone can exec, and cannot be joined.
+ */
+
+// create a thread executing fn( x ), with a stack of n bytes (or 4KiB if n = 0); return its PID, or -1 if impossible
+extern pid_t thread_create( void* (*fn)( void* x ), void* x, size_t n );
+// terminate the calling thread, with x as the value thread_join collects
+extern void  thread_exit( void* x );
+// wait for thread t, in the same process, to terminate, then store the value it exited with in *x (unless x = NULL); return 0 iff. successful, or -1 otherwise
+extern int   thread_join( pid_t t, void** x );
+
+/* The atomic operations below use LDREX/STREX, so never trap, and act as
+ * full memory barriers.  On top of them, and of futexes (i.e., waiting on
+ * a word of memory until it is woken, iff. the word still has an expected
+ * value), are a mutex, condition variable and semaphore, per
+ *
+ * U. Drepper. Futexes Are Tricky. Technical report, Red Hat, 2011.
+ *
+ * Each one is just a word or two of memory, initialised to zero (bar the
+ * value of a semaphore), which threads share simply by sharing memory; the
+ * uncontended cases are pure USR mode, and only a thread that has to wait,
+ * or to wake some other thread, makes a system call.  Since global
+ * variables are shared by every process, one in a global variable works
+ * between processes, too.
+ */
+
+// atomically replace *x with z iff. it is y; return the old value either way
+extern uint32_t atomic_cas( volatile uint32_t* x, uint32_t y, uint32_t z );
+// atomically replace *x with y; return the old value
+extern uint32_t atomic_xchg( volatile uint32_t* x, uint32_t y );
+// atomically add y to *x; return the new value
+extern uint32_t atomic_add( volatile uint32_t* x, int32_t y );
+
+// wait for a futex_wake on x, iff. *x = y; return 0 once woken, or -1 if *x != y (or x is invalid)
+extern int  futex_wait( volatile uint32_t* x, uint32_t y );
+// wake at most n of the processes waiting on x; return how many were
+extern int  futex_wake( volatile uint32_t* x, int n );
+
+typedef struct {
+  volatile uint32_t state;   // 0 if unlocked, 1 if locked, or 2 if locked with (maybe) some threads waiting
+} mutex_t;
 
-// for process identified by pid, send signal of x
+typedef struct {
+  volatile uint32_t seq;     // incremented by each signal or broadcast
+  volatile uint32_t waiters;
+} cond_t;
+
+typedef struct {
+  volatile uint32_t value;
+  volatile uint32_t waiters;
+} sem_t;
+
+#define MUTEX_INITIALIZER { 0    }
+#define COND_INITIALIZER  { 0, 0 }
+
+extern void mutex_init( mutex_t* m );
+extern void mutex_lock( mutex_t* m );
+// lock m iff. it is unlocked; return true iff. it was
+extern bool mutex_trylock( mutex_t* m );
+extern void mutex_unlock( mutex_t* m );
+
+extern void cond_init( cond_t* c );
+// unlock m, wait for a signal or broadcast on c, then lock m again (which, as usual, may also happen spuriously)
+extern void cond_wait( cond_t* c, mutex_t* m );
+// wake one thread waiting on c
+extern void cond_signal( cond_t* c );
+// wake every thread waiting on c
+extern void cond_broadcast( cond_t* c );
+
+// initialise s with value n
+extern void sem_init( sem_t* s, uint32_t n );
+// wait until the value of s is non-zero, then decrement it
+extern void sem_wait( sem_t* s );
+// decrement the value of s iff. it is non-zero; return true iff. it was
+extern bool sem_trywait( sem_t* s );
+// increment the value of s, waking a thread waiting on it (if any)
+extern void sem_post( sem_t* s );
+
+// return the PID of the executing process
+extern pid_t getpid();
+
+// for process identified by pid, send signal of x; return 0, or -1 if there is no such process
 extern int  kill( pid_t pid, int x );
-// for process identified by pid, set  priority to x
-extern void nice( pid_t pid, int x );
+// for process identified by pid, set  priority (i.e., nice value -20 ... 19) to x; return 0, or -1 if there is no such process
+extern int  nice( pid_t pid, int x );
 
 //TO DO:
 extern int pipe();
 
 extern int open( int fd );
+// drop the hold the executing process has on pipe fd (as its creator, or having opened it), which is freed once nothing holds it; return 0, or -1 if it held none
+extern int close( int fd );
+
+/* Each process has a heap window (per the kernel) in which zeroed pages
+ * are mapped on request, either by moving the break, i.e., the end of
+ * the heap, or as separate regions above it.  Like the stack, it is per-
+ * process, and a fork shares it copy-on-write.
+ */
+
+#define MAP_FAILED    ( ( void* )( -1 ) )
+
+// move the break by n bytes; return the old break, or ( void* )( -1 ) if impossible
+extern void* sbrk( intptr_t n );
+// map a region of n bytes (rounded up to whole pages); return its address, or MAP_FAILED if impossible
+extern void* mmap( size_t n );
+// unmap the n bytes from x, as mapped by mmap; return 0 iff. successful, or -1 otherwise
+extern int   munmap( void* x, size_t n );
+
+/* The allocator below assumes it is the only user of sbrk.  A request is
+ * served in one of three ways, by size:
+ *
+ * - a small block, i.e., at most MALLOC_SMALL bytes including its 8-byte
+ *   header, is rounded up to a power of 2 and popped from the free list
+ *   for that size class: the lists are kept in the thread-local area, and
+ *   refilled by carving up a MALLOC_CHUNK byte large block whenever one is
+ *   empty, so both malloc and free are a handful of instructions and no
+ *   system call,
+ * - a large block comes from an arena at the start of the heap, which is
+ *   grown via sbrk: free large blocks are kept in bins by power of 2, and
+ *   have boundary tags, so a block being freed is coalesced with either
+ *   neighbour that is free too, and
+ * - a huge block, i.e., of at least MALLOC_HUGE bytes, is a region of its
+ *   own via mmap, so is given back to the kernel as soon as it is freed.
+ *
+ * Each thread has free lists of its own, whereas the arena is shared by
+ * every thread in a process, so is protected by a mutex: small blocks are
+ * therefore allocated and freed without any locking, bar the occasional
+ * refill.
+ */
+
+#define MALLOC_CLASSES ( 6 )
+#define MALLOC_SMALL   ( 16 << ( MALLOC_CLASSES - 1 ) )
+#define MALLOC_CHUNK   ( 0x00001000 )
+#define MALLOC_HUGE    ( 0x00020000 )
+
+// allocate n bytes; return the address, or NULL if impossible
+extern void* malloc( size_t n );
+// free x, as allocated by malloc, calloc or realloc (or do nothing, if x = NULL)
+extern void  free( void* x );
+// allocate n elements of size bytes each, all zero; return the address, or NULL if impossible
+extern void* calloc( size_t n, size_t size );
+// resize x (as allocated by malloc, calloc or realloc) to n bytes, moving it if need be; return the address, or NULL if impossible
+extern void* realloc( void* x, size_t n );
+
+/* A real-time process is released once every period, and each job must
+ * then complete (signalled by calling yield) within deadline, using at
+ * most budget of processor time; all three are in microseconds, subject
+ * to budget <= deadline <= period.  A period of 0 leaves the real-time
+ * class again.
+ */
+
+// join the real-time class; return 0 iff. admitted, or -1 if over-subscribed
+extern int sched_rt( uint32_t period, uint32_t budget, uint32_t deadline );
+// for process identified by pid, return number of missed deadlines (or -1)
+extern int sched_rt_misses( pid_t pid );
+
+/* A snapshot of a process' status and accounting, as filled in by ps:
+ * times are in microseconds, and the idle task is included (as PID 0).
+ */
+
+#define PROC_CREATED    ( 0 )
+#define PROC_READY      ( 1 )
+#define PROC_EXECUTING  ( 2 )
+#define PROC_WAITING    ( 3 )
+#define PROC_TERMINATED ( 4 ) // i.e., a zombie, whose exit status (or value, if a thread) is yet to be collected
+
+typedef struct {
+  pid_t    pid;
+  int      status;    // PROC_CREATED ... PROC_TERMINATED
+  int      nice;
+  uint32_t utime;     // time executing in USR mode
+  uint32_t stime;     // time executing in the kernel
+  uint32_t nvcsw;     //   voluntary context switches, i.e., blocked
+  uint32_t nivcsw;    // involuntary context switches, i.e., preempted or yielded
+  uint32_t syscalls;  // system calls made
+} procinfo_t;
+
+// snapshot at most n processes into x; return the number of processes
+extern int ps( procinfo_t* x, int n );
+
+// set the kernel log level to x (0 = errors ... 3 = debug), or leave it as is iff. x < 0; return the previous level
+extern int loglevel( int x );
+
+/* A snapshot of the usage of kernel memory, as filled in by kmem: the
+ * first describes the page allocator, with an object being a page (and
+ * slabs the number of pages in the largest free block), and the rest a
+ * slab cache each.
+ */
+
+typedef struct {
+  char     name[ 8 ];
+  uint32_t size;      // object size, in bytes
+  uint32_t inuse;     // objects allocated
+  uint32_t total;     // objects allocated or free
+  uint32_t slabs;     // slabs allocated
+  uint32_t allocs;    // allocations made
+  uint32_t fails;     // allocations that failed
+} kmeminfo_t;
+
+// snapshot at most n of the page allocator and slab caches into x; return the number snapshot
+extern int kmem( kmeminfo_t* x, int n );
+
+// read the cycle counter (at CPU_HZ)
+extern uint32_t cycles();
+// copy at most n of the most recent timer interrupt entry latencies, in cycles, into x; return the number copied
+extern int irq_latency( uint32_t* x, int n );
+
+/* Buffered output is supported by a limited model of stdio: a FILE just
+ * buffers output to a file descriptor, in one of three modes, namely
+ *
+ * - _IOFBF, i.e., fully buffered: written once the buffer is full,
+ * - _IOLBF, i.e., line  buffered: written once the buffer is full, or a
+ *   new line character is output, or
+ * - _IONBF, i.e.,       unbuffered: written straight away.
+ *
+ * stdout is line buffered if it is a terminal and fully buffered if not,
+ * and stderr is unbuffered; both are flushed by exit.  Since processes
+ * share global variables, each process' stdout and stderr live in its
+ * thread-local area instead, so are initialised on first use.
+ */
+
+#define BUFSIZ        ( 128 )
+#define EOF           (  -1 )
+
+#define _IOFBF        ( 0 )
+#define _IOLBF        ( 1 )
+#define _IONBF        ( 2 )
+
+typedef struct {
+  int  fd;
+  int  mode;
+  int  n;             // number of bytes buffered
+  char buf[ BUFSIZ ];
+} FILE;
+
+typedef struct {
+  bool     init;      // true iff. initialised
+  uint32_t writes;    // number of write system calls made, i.e., traps
+  FILE     out;
+  FILE     err;
+  void*    bins[ MALLOC_CLASSES ]; // free small blocks, per size class (see malloc)
+  void*    arena;     // large block state (see malloc), or NULL until malloc is first used
+} tls_t;
+
+_Static_assert( sizeof( tls_t ) <= TLS_SIZE, "tls_t must fit in the thread-local area" );
+
+#define stdout        ( &tls()->out )
+#define stderr        ( &tls()->err )
+
+// return the thread-local area of the executing process
+extern tls_t* tls();
+
+// return 1 iff. file descriptor fd is a terminal, or 0 otherwise
+extern int    isatty( int fd );
+
+// set the buffering mode of f to x (flushing anything already buffered), ignoring buf and n; return 0 iff. successful
+extern int    setvbuf( FILE* f, char* buf, int x, size_t n );
+// write anything buffered by f; return 0 iff. successful, or EOF otherwise
+extern int    fflush( FILE* f );
+
+// output character x to f; return x iff. successful, or EOF otherwise
+extern int    fputc( int x, FILE* f );
+// output n elements of size bytes each from x to f; return elements output
+extern size_t fwrite( const void* x, size_t size, size_t n, FILE* f );
+// output string x to f; return >= 0 iff. successful, or EOF otherwise
+extern int    fputs( const char* x, FILE* f );
+
+/* The formatted output functions support the conversions %c, %s, %d, %i,
+ * %u, %x, %X, %p and %%, with an optional field width and 0 flag.
+ */
+
+// output formatted string x, with arguments a, to f; return bytes output
+extern int   vfprintf( FILE* f, const char* x, va_list a );
+// output formatted string x, with arguments ...,  to f; return bytes output
+extern int    fprintf( FILE* f, const char* x, ... );
+// output formatted string x, with arguments ...,  to stdout; return bytes output
+extern int     printf(          const char* x, ... );
 
 #endif